@@ -46,6 +46,8 @@ class FrankensteinConan(ConanFile):
         self.requires('grpc/1.34.1@inexorgame/stable')
         self.requires('qt/5.13.2@bincrafters/stable')
         self.requires('openssl/1.1.1h')
+        # grpc pulls it in as well, the server deflates sampled replies itself for its compression stats
+        self.requires('zlib/1.2.11')
 
     def _configure_cmake(self):
         cmake = CMake(self)
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <grpcpp/support/status.h>
+
+namespace frankenstein {
+
+// Rate limit of 'rate' events per second with bursts of up to 'burst' events. reserve() takes a token and tells when
+// the event may happen: right away while tokens are left, otherwise when the missing token has accrued, so a paced
+// producer just waits until then. A zero rate is unlimited. Not thread-safe.
+class token_bucket
+{
+public:
+    using clock = std::chrono::system_clock;
+
+    token_bucket() = default;
+    token_bucket(double rate, std::size_t burst) :
+        _rate(rate),
+        _burst(static_cast<double>(std::max<std::size_t>(1, burst))),
+        _tokens(_burst)
+    {}
+
+    bool limited() const { return _rate > 0; }
+
+    // takes a token for an event at 'at' or later and returns the time the event may happen
+    clock::time_point reserve(clock::time_point at)
+    {
+        if (!limited())
+            return at;
+
+        refill(at);
+        _tokens -= 1;
+        if (_tokens >= 0)
+            return at;
+        return at + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(-_tokens / _rate));
+    }
+
+    // takes a token if one is left at 'now'
+    bool try_take(clock::time_point now)
+    {
+        if (!limited())
+            return true;
+
+        refill(now);
+        if (_tokens < 1)
+            return false;
+        _tokens -= 1;
+        return true;
+    }
+
+    // as if never used at 'now'
+    bool full(clock::time_point now)
+    {
+        refill(now);
+        return _tokens >= _burst;
+    }
+
+private:
+    void refill(clock::time_point now)
+    {
+        if (_last.time_since_epoch().count() == 0)
+            _last = now;
+        if (now <= _last)
+            return;
+
+        const std::chrono::duration<double> elapsed = now - _last;
+        _tokens = std::min(_burst, _tokens + elapsed.count() * _rate);
+        _last = now;
+    }
+
+    double _rate = 0;
+    double _burst = 1;
+    double _tokens = 1;
+    clock::time_point _last;
+};
+
+// Limits of the server on its clients, zero leaves a limit off. A peer is the client host as grpc reports it without
+// the port, so every connection of one client counts together; all clients of a unix socket are one peer.
+struct admission_options
+{
+    // concurrent server streams (StreamString, StreamInt and the batched ones) of one name, over all peers
+    std::size_t streams_per_name = 0;
+    // concurrent streams of one peer, bidirectional calls included
+    std::size_t streams_per_peer = 0;
+    // new calls of one peer per second (Stats excepted), with bursts of up to call_burst
+    double calls_per_second = 0;
+    std::size_t call_burst = 100;
+    // messages per second of one stream or topic on top of stream_interval, with bursts of up to message_burst
+    double messages_per_second = 0;
+    std::size_t message_burst = 16;
+
+    // the rate limit of one stream
+    token_bucket message_limit() const { return token_bucket(messages_per_second, message_burst); }
+};
+
+struct admission_stats
+{
+    uint64_t admitted = 0;       // calls and streams let through while a limit applies to them
+    uint64_t rejected_rate = 0;  // calls over the call rate of their peer
+    uint64_t rejected_name = 0;  // streams over the limit of their name
+    uint64_t rejected_peer = 0;  // streams over the limit of their peer
+};
+
+class admission_control;
+
+// One admitted stream, counted against the limits of its name and peer until it is reset or destroyed.
+class admission_ticket
+{
+public:
+    admission_ticket() = default;
+    ~admission_ticket() { reset(); }
+
+    admission_ticket(const admission_ticket&) = delete;
+    admission_ticket& operator=(const admission_ticket&) = delete;
+    // the stream stays counted once, by the ticket moved to
+    admission_ticket(admission_ticket&& other) noexcept;
+    admission_ticket& operator=(admission_ticket&& other) noexcept;
+
+    void reset();
+
+private:
+    friend class admission_control;
+
+    admission_control* _control = nullptr;
+    std::string _name;
+    std::string _peer;
+};
+
+// Admission of new calls, shared by every queue (or every reactor) of a server. A rejected call is finished with
+// RESOURCE_EXHAUSTED before it produces anything: the callback engine admits before it builds the reactor, a queue
+// handler (pooled ahead of its call) as soon as its call is matched. The counters sit behind one mutex, taken when a
+// stream starts or ends with some limit on and by a unary call only with a call rate set.
+class admission_control
+{
+public:
+    explicit admission_control(const admission_options& options);
+
+    admission_control(const admission_control&) = delete;
+    admission_control& operator=(const admission_control&) = delete;
+
+    // some limit is on
+    bool enabled() const { return _enabled; }
+
+    // a unary call of the peer of 'context', only the call rate applies to it
+    template <typename Context>
+    ::grpc::Status admit_call(const Context& context)
+    {
+        return _options.calls_per_second > 0 ? admit(std::string(), context.peer(), nullptr) : ::grpc::Status::OK;
+    }
+
+    // a stream of 'name' (empty for bidirectional calls, which switch names) from the peer of 'context', the empty
+    // 'ticket' holds it until the stream is gone
+    template <typename Context>
+    ::grpc::Status admit_stream(const std::string& name, const Context& context, admission_ticket& ticket)
+    {
+        return _enabled ? admit(name, context.peer(), &ticket) : ::grpc::Status::OK;
+    }
+
+    admission_stats stats() const;
+
+    // "ipv4:10.0.0.1:53044" -> "ipv4:10.0.0.1", "ipv6:[::1]:53044" -> "ipv6:[::1]", anything else as it is
+    static std::string peer_host(const std::string& peer);
+
+private:
+    friend class admission_ticket;
+
+    struct peer_entry
+    {
+        std::size_t streams = 0;
+        token_bucket calls;
+    };
+
+    ::grpc::Status admit(const std::string& name, const std::string& peer, admission_ticket* ticket);
+    void leave(const std::string& name, const std::string& peer);
+    // drops the peers without streams whose call budget is full again, they are as good as new
+    void sweep(token_bucket::clock::time_point now);
+
+    const admission_options _options;
+    const bool _enabled;
+
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, std::size_t> _names;
+    std::unordered_map<std::string, peer_entry> _peers;
+    std::size_t _sweep_at = 1024;
+    admission_stats _stats;
+};
+
+} // namespace frankenstein
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+#include <google/protobuf/arena.h>
+
+namespace frankenstein {
+
+struct arena_options
+{
+    // allocate request/reply messages (and their strings) on a per-handler arena
+    bool enabled = false;
+    // streaming readers give the arena memory back after this many messages
+    std::size_t reset_reads = 64;
+};
+
+// Optional per-handler arena. Its first block is allocated with the arena and kept by the handler, so with pooled
+// handlers small messages rarely touch the global allocator. Without the arena the handler carries no block at all.
+class handler_arena
+{
+public:
+    static constexpr std::size_t initial_block_size = 1024;
+
+    explicit handler_arena(const arena_options& options) : _reset_reads(options.reset_reads)
+    {
+        if (options.enabled) {
+            _block.reset(new char[initial_block_size]);
+            google::protobuf::ArenaOptions arena_options;
+            arena_options.initial_block = _block.get();
+            arena_options.initial_block_size = initial_block_size;
+            _arena.emplace(arena_options);
+        }
+    }
+
+    handler_arena(const handler_arena&) = delete;
+    handler_arena& operator=(const handler_arena&) = delete;
+
+    google::protobuf::Arena* get() { return _arena ? &*_arena : nullptr; }
+
+    // counts one read, true when the arena has to be reset before the next one
+    bool read_done() { return _arena && _reset_reads && ++_reads % _reset_reads == 0; }
+    // every message created on the arena so far is gone after this
+    void reset()
+    {
+        if (_arena)
+            _arena->Reset();
+    }
+
+private:
+    // new[] aligns for any fundamental type, as the arena needs; declared first so it outlives the arena
+    std::unique_ptr<char[]> _block;
+    std::optional<google::protobuf::Arena> _arena;
+
+    const std::size_t _reset_reads;
+    std::size_t _reads = 0;
+};
+
+// Message allocated on an arena or, without one, kept inline like a plain member. The inline message is only
+// constructed without an arena.
+template <typename Message>
+class arena_message
+{
+public:
+    explicit arena_message(google::protobuf::Arena* arena) : _message(create(arena)) {}
+
+    arena_message(const arena_message&) = delete;
+    arena_message& operator=(const arena_message&) = delete;
+
+    Message* get() { return _message; }
+    const Message* get() const { return _message; }
+    Message* operator->() { return _message; }
+    const Message* operator->() const { return _message; }
+    Message& operator*() { return *_message; }
+    const Message& operator*() const { return *_message; }
+
+    // must be called after handler_arena::reset(), the previous message is gone with the arena memory
+    void renew(google::protobuf::Arena* arena) { _message = create(arena); }
+
+private:
+    Message* create(google::protobuf::Arena* arena)
+    {
+        if (!arena) {
+            if (_local)
+                _local->Clear();
+            else
+                _local.emplace();
+            return &*_local;
+        }
+        return google::protobuf::Arena::CreateMessage<Message>(arena);
+    }
+
+    std::optional<Message> _local;
+    Message* _message;
+};
+
+} // namespace frankenstein
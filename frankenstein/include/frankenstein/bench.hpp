@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <grpcpp/channel.h>
+
+#include <frankenstein/histogram.hpp>
+#include <frankenstein/transport.hpp>
+
+namespace frankenstein {
+
+enum class bench_method
+{
+    PING,
+    STREAM_STRING,
+    STREAM_INT,
+    STREAM_STRING_BATCH,
+    STREAM_INT_BATCH
+};
+
+const char* to_string(bench_method method);
+// returns false on unknown name
+bool from_string(const std::string& name, bench_method& method);
+
+struct bench_options
+{
+    // host:port dialed over TCP, UNIX dials the socket of 'transport' instead and IN_PROCESS is given its channel
+    std::string target = "0.0.0.0:50051";
+    transport_options transport;
+    bench_method method = bench_method::PING;
+
+    // outstanding calls for Ping, open streams for StreamString/StreamInt
+    std::size_t concurrency = 16;
+    // completion queues, each drained by its own thread
+    std::size_t threads = 1;
+    // new calls per second over all slots, zero starts the next call as soon as the previous one is done
+    double rate = 0;
+    std::chrono::milliseconds duration{10000};
+};
+
+struct bench_result
+{
+    bench_options options;
+    // engine reported by the Stats RPC of the server, so runs against both engines can be told apart
+    std::string server_engine;
+
+    uint64_t calls = 0;    // completed calls
+    uint64_t messages = 0; // received values, a batch counts as many as it carries
+    uint64_t errors = 0;   // calls finished with a non-OK status (besides the ones cancelled at the end)
+
+    double seconds = 0;     // wall time
+    double cpu_seconds = 0; // user + system time of this process
+
+    // Ping: call round trip. Streams: per message, from the sent_at_ns the server stamped it with to its arrival, one
+    // sample per batch; as exact as the clocks of both hosts agree, so best measured on one host
+    latency_histogram latency;
+    // streams: time from the call start to the first value, the empty message that opens a stream is not counted
+    latency_histogram first_message;
+    // streams: time between two messages that carry values, mostly the pacing of the server (--stream-interval)
+    latency_histogram message_gap;
+
+    std::string to_text() const;
+    std::string to_json() const;
+};
+
+// drives the configured method against a running server for options.duration
+bench_result run_bench(const bench_options& options);
+// same over 'channel', e.g. the in-process channel of a server in this binary
+bench_result run_bench(const bench_options& options, std::shared_ptr<::grpc::Channel> channel);
+
+} // namespace frankenstein
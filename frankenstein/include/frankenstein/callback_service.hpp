@@ -0,0 +1,76 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <proto/exchange_service.grpc.pb.h>
+
+#include <frankenstein/admission.hpp>
+#include <frankenstein/reply_cache.hpp>
+#include <frankenstein/send_queue.hpp>
+#include <frankenstein/server.hpp>
+
+namespace frankenstein {
+
+using callback_server_context = ::grpc::CallbackServerContext;
+
+// Ping and StreamString are served raw, as on the completion queue engine
+using callback_service_base = proto::ExchangeService::WithRawCallbackMethod_Ping<
+    proto::ExchangeService::WithRawCallbackMethod_StreamString<proto::ExchangeService::CallbackService>>;
+
+// ExchangeService on the callback API. Every call is a reactor run by the threads of grpc itself, so the server has
+// no queue to poll. The reactors reuse the building blocks of the queue handlers (reply cache, batch coalescer, send
+// queues, metrics) and write the same message sequences at the same pace.
+class callback_service : public callback_service_base
+{
+public:
+    // 'admission' is shared with the server, which logs its counters
+    callback_service(const server_options& options, std::shared_ptr<admission_control> admission);
+
+    ::grpc::ServerUnaryReactor* Ping(callback_server_context* context,
+                                     const ::grpc::ByteBuffer* request,
+                                     ::grpc::ByteBuffer* reply) override;
+    ::grpc::ServerUnaryReactor* Stats(callback_server_context* context,
+                                      const proto::EmptyRequest* request,
+                                      proto::StatsReply* reply) override;
+
+    ::grpc::ServerWriteReactor<::grpc::ByteBuffer>* StreamString(callback_server_context* context,
+                                                                 const ::grpc::ByteBuffer* request) override;
+    ::grpc::ServerWriteReactor<proto::IntReply>* StreamInt(callback_server_context* context,
+                                                           const proto::NameRequest* request) override;
+    ::grpc::ServerWriteReactor<proto::StringBatchReply>* StreamStringBatch(callback_server_context* context,
+                                                                           const proto::NameRequest* request) override;
+    ::grpc::ServerWriteReactor<proto::IntBatchReply>* StreamIntBatch(callback_server_context* context,
+                                                                     const proto::NameRequest* request) override;
+
+    ::grpc::ServerBidiReactor<proto::NameRequest, proto::StringReply>* BiStreamString(
+        callback_server_context* context) override;
+    ::grpc::ServerBidiReactor<proto::NameRequest, proto::IntReply>* BiStreamInt(
+        callback_server_context* context) override;
+
+    // encoded reply from the cache shared by all reactors
+    template <typename Reply, typename Fill>
+    ::grpc::ByteBuffer cached_reply(const std::string& key, Fill&& fill)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _replies.get<Reply>(key, 0, std::forward<Fill>(fill));
+    }
+
+    // reactors keep their own send queue counters and add them up here when they are done
+    void merge_send_queue_stats(const send_queue_stats& stats);
+
+    // logs the reply cache and send queue counters
+    void log_stats();
+
+    const server_options options;
+
+private:
+    std::shared_ptr<admission_control> _admission;
+
+    std::mutex _mutex;
+    reply_cache _replies;
+    send_queue_stats _send_queues;
+};
+
+} // namespace frankenstein
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <proto/exchange_service.grpc.pb.h>
+
+namespace frankenstein {
+
+using stub_ptr = std::shared_ptr<proto::ExchangeService::Stub>;
+// opens one channel of a pool with the given args
+using channel_factory = std::function<std::shared_ptr<::grpc::Channel>(const ::grpc::ChannelArguments&)>;
+
+// channels dialing 'target' (host:port or unix:<path>)
+channel_factory remote_channels(const std::string& target);
+
+enum class channel_selection
+{
+    ROUND_ROBIN,       // every call goes to the next channel
+    LEAST_OUTSTANDING, // every call goes to the channel with the fewest calls in flight
+};
+
+// returns false on unknown name
+bool from_string(const std::string& name, channel_selection& selection);
+
+struct channel_options
+{
+    // channels (and so TCP connections) to the server
+    std::size_t channels = 1;
+    channel_selection selection = channel_selection::ROUND_ROBIN;
+};
+
+// Stub of a pooled channel, the call is counted as outstanding on the channel while the handler holds it.
+class pooled_stub
+{
+public:
+    pooled_stub(stub_ptr stub, std::size_t* outstanding) : _stub(std::move(stub)), _outstanding(outstanding)
+    {
+        ++*_outstanding;
+    }
+    ~pooled_stub()
+    {
+        if (_outstanding)
+            --*_outstanding;
+    }
+
+    pooled_stub(pooled_stub&& other) noexcept : _stub(std::move(other._stub)), _outstanding(other._outstanding)
+    {
+        other._outstanding = nullptr;
+    }
+    pooled_stub& operator=(pooled_stub&&) = delete;
+    pooled_stub(const pooled_stub&) = delete;
+    pooled_stub& operator=(const pooled_stub&) = delete;
+
+    proto::ExchangeService::Stub* operator->() const { return _stub.get(); }
+    proto::ExchangeService::Stub& operator*() const { return *_stub; }
+
+private:
+    stub_ptr _stub;
+    std::size_t* _outstanding;
+};
+
+// Several channels to one server. Every channel gets distinct channel args and its own subchannel pool, so grpc does
+// not merge them into one connection. Used from the client's Qt thread only.
+class channel_pool
+{
+public:
+    channel_pool(const channel_factory& factory, const channel_options& options);
+
+    channel_pool(const channel_pool&) = delete;
+    channel_pool& operator=(const channel_pool&) = delete;
+
+    pooled_stub pick();
+
+    std::size_t size() const { return _channels.size(); }
+    std::size_t outstanding(std::size_t index) const { return _channels[index].outstanding; }
+
+private:
+    struct channel_type
+    {
+        stub_ptr stub;
+        std::size_t outstanding = 0;
+    };
+
+    const channel_selection _selection;
+    std::vector<channel_type> _channels;
+    std::size_t _next = 0;
+};
+
+} // namespace frankenstein
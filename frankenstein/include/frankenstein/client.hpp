@@ -1,62 +1,159 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <memory>
+#include <optional>
+#include <vector>
 
 #include <QtCore/QObject>
 #include <QtCore/QTimer>
 
 #include <proto/exchange_service.grpc.pb.h>
 
+#include <frankenstein/arena.hpp>
+#include <frankenstein/channel_pool.hpp>
 #include <frankenstein/commons.hpp>
+#include <frankenstein/coroutine.hpp>
+#include <frankenstein/dispatcher.hpp>
+#include <frankenstein/metrics.hpp>
+#include <frankenstein/pool.hpp>
+#include <frankenstein/reply_sink.hpp>
+#include <frankenstein/stream_registry.hpp>
+#include <frankenstein/transport.hpp>
 
 namespace frankenstein {
 
 using grpc_client_queue_ptr = std::shared_ptr<::grpc::CompletionQueue>;
 using grpc_client_context = ::grpc::ClientContext;
 
-using stub_ptr = std::shared_ptr<proto::ExchangeService::Stub>;
-
 template <class T>
 using client_async_response_reader = ::grpc::ClientAsyncResponseReader<T>;
 template <class T>
 using client_async_reader = ::grpc::ClientAsyncReader<T>;
+template <class W, class R>
+using client_async_reader_writer = ::grpc::ClientAsyncReaderWriter<W, R>;
 
-// ---------------------------------------------------------------------------------------------------------------------
+// Deadline of the calls of every method, counted from the moment the handler is created. Zero leaves the calls of a
+// method without one, a stream still open at its deadline is cancelled on both sides with DEADLINE_EXCEEDED.
+struct call_deadlines
+{
+    // indexed by metric_method
+    std::array<std::chrono::milliseconds, static_cast<std::size_t>(metric_method::COUNT)> methods{};
+
+    std::chrono::milliseconds operator[](metric_method method) const
+    {
+        return methods[static_cast<std::size_t>(method)];
+    }
+
+    void set_all(std::chrono::milliseconds deadline) { methods.fill(deadline); }
+    // "<method>=<msec>" with the method named as in the metrics, e.g. "stream_int=2000", returns false on a malformed
+    // spec
+    bool set(const std::string& spec);
+};
 
-class client_method_handler_stub : public QObject
+// A StreamString/StreamInt call broken by the connection (UNAVAILABLE) before its last value is made again with
+// resume_after set to the last seq it received, the server continues from there. The attempts of a name are counted
+// until its resumed call receives a value, the n-th one waits n * backoff.
+struct resume_options
 {
-    Q_OBJECT
+    bool enabled = true;
+    std::size_t attempts = 5;
+    std::chrono::milliseconds backoff{100};
+};
 
+// ---------------------------------------------------------------------------------------------------------------------
+
+// completion queue tag, kept free of QObject so that a handler can own several of them
+class client_method_handler_stub
+{
 public:
     virtual bool proceed(bool ok) = 0;
     virtual ~client_method_handler_stub() = default;
 };
 
+// Told when a handler it created has reached CLOSED. The handler does not touch itself after the call, so the owner
+// may destroy it right away.
+class client_handler_owner
+{
+public:
+    virtual void handler_closed(client_method_handler_stub* handler, std::size_t cookie) = 0;
+
+protected:
+    ~client_handler_owner() = default;
+};
+
 template <typename Reader, typename Request, typename Reply>
 class client_method_handler : public client_method_handler_stub
 {
 public:
-    client_method_handler() = default;
+    client_method_handler(pooled_stub stub,
+                          const arena_options& arena,
+                          const call_deadlines& deadlines,
+                          metric_method method,
+                          const char* const* state_names) :
+        _stub(std::move(stub)),
+        _arena(arena),
+        _reply(_arena.get()),
+        _metrics(metric_side::CLIENT, method, state_names)
+    {
+        _metrics.start();
+
+        const auto deadline = deadlines[method];
+        if (deadline.count() > 0)
+            _context.set_deadline(std::chrono::system_clock::now() + deadline);
+    }
     virtual ~client_method_handler() = default;
 
     void cancel();
+    void set_owner(client_handler_owner* owner, std::size_t cookie)
+    {
+        _owner = owner;
+        _owner_cookie = cookie;
+    }
 
 protected:
     using reader_type = Reader;
     using request_type = Request;
     using reply_type = Reply;
 
+    // keeps the call counted on its channel until the handler is gone
+    pooled_stub _stub;
     grpc_client_context _context;
     std::unique_ptr<reader_type> _reader;
 
     grpc_status _status;
-    reply_type _reply;
+    handler_arena _arena;
+    arena_message<reply_type> _reply;
+    call_metrics _metrics;
+
+    client_handler_owner* _owner = nullptr;
+    std::size_t _owner_cookie = 0;
+
+    // must be the last thing a closed handler does
+    void notify_closed()
+    {
+        if (_owner)
+            _owner->handler_closed(this, _owner_cookie);
+    }
+
+    // prepares _reply for the next Read, the arena is recycled every arena_options::reset_reads messages
+    void next_reply()
+    {
+        if (_arena.read_done()) {
+            _arena.reset();
+            _reply.renew(_arena.get());
+        } else {
+            _reply->Clear();
+        }
+    }
 };
 
 template <typename Reader, typename Request, typename Reply>
 void client_method_handler<Reader, Request, Reply>::cancel()
 {
-    LOG("client_method_handler::cancel()");
+    LOG_TRACE("client_method_handler::cancel()");
     _context.TryCancel();
 }
 
@@ -67,40 +164,92 @@ template <typename Request, typename Reply>
 class client_method_handler_oto : public client_method_handler<client_async_response_reader<Reply>, Request, Reply>
 {
 public:
-    client_method_handler_oto() = default;
+    client_method_handler_oto(pooled_stub stub,
+                              const arena_options& arena,
+                              const call_deadlines& deadlines,
+                              metric_method method) :
+        client_method_handler<client_async_response_reader<Reply>, Request, Reply>(std::move(stub),
+                                                                                   arena,
+                                                                                   deadlines,
+                                                                                   method,
+                                                                                   state_names)
+    {}
+
+protected:
+    static constexpr const char* state_names[] = {"CALL", nullptr};
 };
 
 class ping_client_handler : public client_method_handler_oto<proto::EmptyRequest, proto::StringReply>
 {
 public:
-    ping_client_handler(const request_type& request, stub_ptr stub, grpc_client_queue_ptr queue);
+    using pool_type = object_pool<ping_client_handler>;
+
+    ping_client_handler(const request_type& request,
+                        pooled_stub stub,
+                        grpc_client_queue_ptr queue,
+                        const arena_options& arena,
+                        const call_deadlines& deadlines,
+                        pool_type& pool);
     ~ping_client_handler() override;
 
     bool proceed(bool ok) override;
+
+private:
+    pool_type& _pool;
 };
 
 // ---------------------------------------------------------------------------------------------------------------------
 // one-to-many handler
 
-template <typename Request, typename Reply>
-class client_method_handler_otm : public client_method_handler<client_async_reader<Reply>, Request, Reply>
+// Server stream of one method read to its end, everything the methods differ in comes from 'Traits':
+//   reply_type                   reply message
+//   value_type                   message of one value, what the reply sink of the method is given
+//   method                       metric_method of the call
+//   prepare                      stub member preparing the call
+//   consume(reply, name, sink)   handles the values of one reply
+//   seq(reply)                   sequence number of a reply, zero for the empty opening message and for batches
+//   sequenced                    the replies carry seq, so a broken call can be resumed
+//   name                         handler name for logging
+// The stream is read until Read() fails, then the status from Finish() tells a clean end from a broken call.
+// The states are dispatched in proceed() without any virtual call, proceed() is the whole vtable.
+template <typename Traits>
+class stream_client_handler final :
+    public client_method_handler<client_async_reader<typename Traits::reply_type>,
+                                 proto::NameRequest,
+                                 typename Traits::reply_type>
 {
-protected:
-    using request_type = Request;
-
 public:
-    client_method_handler_otm(const request_type& request, stub_ptr stub, grpc_client_queue_ptr queue);
+    using value_type = typename Traits::value_type;
+    using sink_ptr = std::shared_ptr<reply_sink<value_type>>;
+
+    stream_client_handler(const proto::NameRequest& request,
+                          pooled_stub stub,
+                          grpc_client_queue_ptr queue,
+                          const arena_options& arena,
+                          const call_deadlines& deadlines);
+    ~stream_client_handler() override { LOG_TRACE("%s::dtor()", Traits::name); }
+
+    stream_client_handler(const stream_client_handler&) = delete;
+    stream_client_handler& operator=(const stream_client_handler&) = delete;
 
     bool proceed(bool ok) override;
-    bool is_closed() const { return _state == handler_state::CLOSED; };
 
-protected:
-    virtual void handle_call_state() = 0;
-    virtual void handle_write_state() = 0;
-    virtual void handle_wait_state() = 0;
-    virtual void handle_read_state() = 0;
-    virtual void handle_finish_state() = 0;
+    // receives the values of the stream besides the log
+    void set_sink(sink_ptr sink) { _sink = std::move(sink); }
 
+    const std::string& name() const { return _request.name(); }
+    // the seq of the last message received, or the resume point of the call when none came yet
+    uint64_t last_seq() const { return _last_seq; }
+    // closed with the connection broken, the call goes on after last_seq()
+    bool resumable() const
+    {
+        return Traits::sequenced && _state == handler_state::CLOSED &&
+               this->_status.error_code() == ::grpc::StatusCode::UNAVAILABLE;
+    }
+    // resumes of the stream in a row without a value in between, kept by the container
+    std::size_t resumes = 0;
+
+private:
     enum class handler_state
     {
         CALL,
@@ -110,57 +259,117 @@ protected:
         FINISH,
         CLOSED
     };
+    static constexpr const char* state_names[] = {"CALL", "WRITE", "WAIT", "READ", "FINISH", "CLOSED", nullptr};
+
+    // one message of the stream
+    void received();
 
-    stub_ptr _stub;
     grpc_client_queue_ptr _queue;
-    request_type _request;
+    proto::NameRequest _request;
+    sink_ptr _sink;
 
     handler_state _state = handler_state::CALL;
+    uint64_t _last_seq;
 };
 
-template <typename Request, typename Reply>
-client_method_handler_otm<Request, Reply>::client_method_handler_otm(const Request& request,
-                                                                     stub_ptr stub,
-                                                                     grpc_client_queue_ptr queue) :
-    client_method_handler<client_async_reader<Reply>, Request, Reply>(),
-    _stub(stub),
+template <typename Traits>
+stream_client_handler<Traits>::stream_client_handler(const proto::NameRequest& request,
+                                                     pooled_stub stub,
+                                                     grpc_client_queue_ptr queue,
+                                                     const arena_options& arena,
+                                                     const call_deadlines& deadlines) :
+    client_method_handler<client_async_reader<typename Traits::reply_type>,
+                          proto::NameRequest,
+                          typename Traits::reply_type>(std::move(stub), arena, deadlines, Traits::method, state_names),
     _queue(queue),
-    _request(request)
-{}
+    _request(request),
+    _last_seq(request.resume_after())
+{
+    LOG_TRACE("%s::ctor()", Traits::name);
 
-template <typename Request, typename Reply>
-bool client_method_handler_otm<Request, Reply>::proceed(bool ok)
+    proceed(true);
+}
+
+template <typename Traits>
+void stream_client_handler<Traits>::received()
 {
-    LOG("client_method_handler_otm::proceed()");
+    // read before the sink takes the reply
+    const auto seq = Traits::seq(*this->_reply);
+    // the last value is written once more with the end of the stream
+    if (seq && seq == _last_seq)
+        return;
+
+    this->_metrics.received();
+
+    if (seq) {
+        if (_last_seq && seq > _last_seq + 1)
+            LOG_DEBUG("%s::received(name=%s): %lu messages missed", Traits::name, name().c_str(), seq - _last_seq - 1);
+        else if (seq < _last_seq)
+            LOG_DEBUG("%s::received(name=%s): the stream started over", Traits::name, name().c_str());
+        _last_seq = seq;
+        resumes = 0;
+    }
+
+    Traits::consume(*this->_reply, _request.name(), _sink.get());
+}
+
+template <typename Traits>
+bool stream_client_handler<Traits>::proceed(bool ok)
+{
+    LOG_TRACE("%s::proceed()", Traits::name);
+
+    this->_metrics.state_done(_state);
 
     try {
-        if (ok) {
-            if (_state == handler_state::CALL) {
-                this->handle_call_state();
-            } else if (_state == handler_state::WRITE) {
-                this->handle_write_state();
-            } else if (_state == handler_state::WAIT) {
-                this->handle_wait_state();
-            } else if (_state == handler_state::READ) {
-                this->handle_read_state();
-            } else if (_state == handler_state::FINISH) {
-                this->handle_finish_state();
-                return false;
-            }
-        } else {
+        if (!ok) {
             _state = handler_state::FINISH;
             this->_reader->Finish(&this->_status, this);
+            return true;
+        }
+
+        switch (_state) {
+        case handler_state::CALL:
+            this->_reader = ((*this->_stub).*Traits::prepare)(&this->_context, _request, _queue.get());
+            _state = handler_state::WRITE;
+            this->_reader->StartCall(this);
+            break;
+        case handler_state::WRITE:
+            _state = handler_state::WAIT;
+            this->_reader->Read(this->_reply.get(), this);
+            break;
+        case handler_state::WAIT:
+            // the empty message opening the stream, a stream without one starts with its first value
+            if (Traits::seq(*this->_reply))
+                received();
+            _state = handler_state::READ;
+            this->next_reply();
+            this->_reader->Read(this->_reply.get(), this);
+            break;
+        case handler_state::READ:
+            received();
+            this->next_reply();
+            this->_reader->Read(this->_reply.get(), this);
+            break;
+        case handler_state::FINISH:
+            if (!this->_status.ok())
+                this->_metrics.fail();
+            this->_metrics.finish();
+            _state = handler_state::CLOSED;
+            this->notify_closed();
+            return false;
+        case handler_state::CLOSED:
+            break;
         }
 
         return true;
     } catch (std::exception& e) {
-        LOG("client_method_handler_otm::proceed(): processing error: " + std::string(e.what()));
+        LOG_WARN("%s::proceed(): processing error: %s", Traits::name, e.what());
     } catch (...) {
-        LOG("client_method_handler_otm::proceed(): processing error: unknown exception caught");
+        LOG_WARN("%s::proceed(): processing error: unknown exception caught", Traits::name);
     }
 
     if (_state == handler_state::CALL) {
-        LOG("client_method_handler_otm::proceed(): return after exception on state=CALL");
+        LOG_WARN("%s::proceed(): return after exception on state=CALL", Traits::name);
         return false;
     }
 
@@ -170,114 +379,751 @@ bool client_method_handler_otm<Request, Reply>::proceed(bool ok)
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
+// many-to-many handler
 
-class stream_string_client_handler : public client_method_handler_otm<proto::NameRequest, proto::StringReply>
+// Completion tag of one direction of a many-to-many call, forwards reads and writes to the handler.
+template <typename Handler>
+class client_method_handler_tag : public client_method_handler_stub
 {
 public:
-    stream_string_client_handler(const request_type& request, stub_ptr stub, grpc_client_queue_ptr queue);
-    ~stream_string_client_handler() override;
+    using callback_type = void (Handler::*)(bool ok);
+
+    client_method_handler_tag(Handler* handler, callback_type callback) : _handler(handler), _callback(callback) {}
+
+    bool proceed(bool ok) override
+    {
+        (_handler->*_callback)(ok);
+        return true;
+    }
 
 private:
-    void handle_call_state() override;
-    void handle_write_state() override;
-    void handle_wait_state() override;
-    void handle_read_state() override;
-    void handle_finish_state() override;
+    Handler* _handler;
+    callback_type _callback;
 };
 
-class stream_int_client_handler : public client_method_handler_otm<proto::NameRequest, proto::IntReply>
+// Bidirectional stream of one method, switched between names by its requests. Everything the methods differ in comes
+// from 'Traits':
+//   reply_type                   reply message, also what the reply sink of the method is given
+//   method                       metric_method of the call
+//   prepare                      stub member preparing the call
+//   consume(reply, name, sink)   handles one reply for the name requested last
+//   name                         handler name for logging
+// The states are dispatched without any virtual call, proceed() is the whole vtable.
+template <typename Traits>
+class bi_stream_client_handler final :
+    public client_method_handler<client_async_reader_writer<proto::NameRequest, typename Traits::reply_type>,
+                                 proto::NameRequest,
+                                 typename Traits::reply_type>
 {
 public:
-    stream_int_client_handler(const request_type& request, stub_ptr stub, grpc_client_queue_ptr queue);
-    ~stream_int_client_handler() override;
+    using request_type = proto::NameRequest;
+    using value_type = typename Traits::reply_type;
+    using sink_ptr = std::shared_ptr<reply_sink<value_type>>;
+
+    bi_stream_client_handler(pooled_stub stub,
+                             grpc_client_queue_ptr queue,
+                             const arena_options& arena,
+                             const call_deadlines& deadlines);
+    ~bi_stream_client_handler() override { LOG_TRACE("%s::dtor()", Traits::name); }
+
+    bi_stream_client_handler(const bi_stream_client_handler&) = delete;
+    bi_stream_client_handler& operator=(const bi_stream_client_handler&) = delete;
+
+    // call tag: StartCall and Finish, reads and writes complete on their own tags
+    bool proceed(bool ok) override;
+
+    // sends a request on the running call, requests not written yet are superseded by the latest one
+    void write(const request_type& request);
+    // half-closes the call after the pending request, the server finishes it with its last reply
+    void close();
+
+    // a request written now still reaches the server
+    bool is_writable() const { return _state <= handler_state::STREAM && !_closing && !_reads_done; }
+    bool is_closed() const { return _state == handler_state::CLOSED; };
+
+    // receives the replies of the call besides the log, takes effect with the next reply
+    void set_sink(sink_ptr sink) { _sink = std::move(sink); }
 
 private:
-    void handle_call_state() override;
-    void handle_write_state() override;
-    void handle_wait_state() override;
-    void handle_read_state() override;
-    void handle_finish_state() override;
+    enum class handler_state
+    {
+        CALL,
+        START,
+        STREAM,
+        FINISH,
+        CLOSED
+    };
+    static constexpr const char* state_names[] = {"CALL", "START", "STREAM", "FINISH", "CLOSED", nullptr};
+
+    grpc_client_queue_ptr _queue;
+    sink_ptr _sink;
+
+    handler_state _state = handler_state::CALL;
+
+    void read();
+    void read_done(bool ok);
+    void write_done(bool ok);
+    // writes the pending request or WritesDone, one write at a time
+    void flush();
+    void try_finish();
+
+    client_method_handler_tag<bi_stream_client_handler> _read_tag;
+    client_method_handler_tag<bi_stream_client_handler> _write_tag;
+
+    // the request written last, the replies are for its name
+    request_type _request;
+    std::optional<request_type> _pending;
+    bool _writing = false;
+    bool _closing = false;
+    bool _writes_done = false;
+    bool _reads_done = false;
+};
+
+template <typename Traits>
+bi_stream_client_handler<Traits>::bi_stream_client_handler(pooled_stub stub,
+                                                           grpc_client_queue_ptr queue,
+                                                           const arena_options& arena,
+                                                           const call_deadlines& deadlines) :
+    client_method_handler<client_async_reader_writer<proto::NameRequest, typename Traits::reply_type>,
+                          proto::NameRequest,
+                          typename Traits::reply_type>(std::move(stub), arena, deadlines, Traits::method, state_names),
+    _queue(queue),
+    _read_tag(this, &bi_stream_client_handler::read_done),
+    _write_tag(this, &bi_stream_client_handler::write_done)
+{
+    LOG_TRACE("%s::ctor()", Traits::name);
+
+    proceed(true);
+}
+
+template <typename Traits>
+bool bi_stream_client_handler<Traits>::proceed(bool ok)
+{
+    LOG_TRACE("%s::proceed()", Traits::name);
+
+    this->_metrics.state_done(_state);
+
+    if (_state == handler_state::CALL) {
+        this->_reader = ((*this->_stub).*Traits::prepare)(&this->_context, _queue.get());
+        _state = handler_state::START;
+        this->_reader->StartCall(this);
+    } else if (_state == handler_state::START) {
+        if (!ok) {
+            LOG_WARN("%s::proceed(): call is not started", Traits::name);
+            _reads_done = true;
+            _writes_done = true;
+            try_finish();
+            return true;
+        }
+        _state = handler_state::STREAM;
+        read();
+        flush();
+    } else if (_state == handler_state::FINISH) {
+        if (this->_status.ok()) {
+            LOG_DEBUG("%s::proceed(): status success", Traits::name);
+        } else {
+            LOG_WARN("%s::proceed(): status fail: %s", Traits::name, this->_status.error_message().c_str());
+            this->_metrics.fail();
+        }
+        this->_metrics.finish();
+        _state = handler_state::CLOSED;
+        this->notify_closed();
+        return false;
+    }
+
+    return true;
+}
+
+template <typename Traits>
+void bi_stream_client_handler<Traits>::write(const request_type& request)
+{
+    if (!is_writable()) {
+        LOG_WARN("%s::write(): call is closed for writes", Traits::name);
+        return;
+    }
+
+    _pending = request;
+    flush();
+}
+
+template <typename Traits>
+void bi_stream_client_handler<Traits>::close()
+{
+    LOG_TRACE("%s::close()", Traits::name);
+
+    _closing = true;
+    flush();
+}
+
+template <typename Traits>
+void bi_stream_client_handler<Traits>::read()
+{
+    this->_reader->Read(this->_reply.get(), &_read_tag);
+}
+
+template <typename Traits>
+void bi_stream_client_handler<Traits>::read_done(bool ok)
+{
+    LOG_TRACE("%s::read_done(ok=%d)", Traits::name, ok);
+
+    if (!ok) {
+        // server finished the call or the call is gone
+        _reads_done = true;
+        try_finish();
+        return;
+    }
+
+    this->_metrics.received();
+    try {
+        Traits::consume(*this->_reply, _request.name(), _sink.get());
+    } catch (std::exception& e) {
+        LOG_WARN("%s::read_done(): processing error: %s", Traits::name, e.what());
+        this->_context.TryCancel();
+    }
+
+    this->next_reply();
+    read();
+}
+
+template <typename Traits>
+void bi_stream_client_handler<Traits>::write_done(bool ok)
+{
+    LOG_TRACE("%s::write_done(ok=%d)", Traits::name, ok);
+
+    _writing = false;
+    if (!ok) {
+        // the stream is broken, the read side finds out as well
+        _pending.reset();
+        _writes_done = true;
+    } else {
+        this->_metrics.sent();
+    }
+
+    flush();
+    try_finish();
+}
+
+template <typename Traits>
+void bi_stream_client_handler<Traits>::flush()
+{
+    if (_writing || _state != handler_state::STREAM || _writes_done)
+        return;
+
+    if (_pending) {
+        _request = std::move(*_pending);
+        _pending.reset();
+        _writing = true;
+        this->_reader->Write(_request, &_write_tag);
+    } else if (_closing) {
+        _writes_done = true;
+        _writing = true;
+        this->_reader->WritesDone(&_write_tag);
+    }
+}
+
+template <typename Traits>
+void bi_stream_client_handler<Traits>::try_finish()
+{
+    if (!_reads_done || _writing || _state >= handler_state::FINISH)
+        return;
+
+    LOG_TRACE("%s::try_finish(): finish", Traits::name);
+    _state = handler_state::FINISH;
+    this->_reader->Finish(&this->_status, this);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// one-to-many methods, a new one needs its traits and a streams_container in client
+
+struct stream_string_client_traits
+{
+    using reply_type = proto::StringReply;
+    using value_type = proto::StringReply;
+    static constexpr metric_method method = metric_method::STREAM_STRING;
+    static constexpr auto prepare = &proto::ExchangeService::Stub::PrepareAsyncStreamString;
+    static constexpr const char* name = "stream_string_client_handler";
+
+    static void consume(reply_type& reply, const std::string& stream, reply_sink<value_type>* sink)
+    {
+        LOG_DEBUG("result: %s", reply.msg().c_str());
+        if (sink)
+            sink->push(stream, reply);
+    }
+    static uint64_t seq(const reply_type& reply) { return reply.seq(); }
+    static constexpr bool sequenced = true;
 };
 
+struct stream_int_client_traits
+{
+    using reply_type = proto::IntReply;
+    using value_type = proto::IntReply;
+    static constexpr metric_method method = metric_method::STREAM_INT;
+    static constexpr auto prepare = &proto::ExchangeService::Stub::PrepareAsyncStreamInt;
+    static constexpr const char* name = "stream_int_client_handler";
+
+    static void consume(reply_type& reply, const std::string& stream, reply_sink<value_type>* sink)
+    {
+        LOG_DEBUG("result: %d", reply.msg());
+        if (sink)
+            sink->push(stream, reply);
+    }
+    static uint64_t seq(const reply_type& reply) { return reply.seq(); }
+    static constexpr bool sequenced = true;
+};
+
+using stream_string_client_handler = stream_client_handler<stream_string_client_traits>;
+using stream_int_client_handler = stream_client_handler<stream_int_client_traits>;
+
 // ---------------------------------------------------------------------------------------------------------------------
+// one-to-many batched handler, every value of a batch is handled as if it came in its own message
+
+struct stream_string_batch_client_traits
+{
+    using reply_type = proto::StringBatchReply;
+    using value_type = proto::StringReply;
+    static constexpr metric_method method = metric_method::STREAM_STRING_BATCH;
+    static constexpr auto prepare = &proto::ExchangeService::Stub::PrepareAsyncStreamStringBatch;
+    static constexpr const char* name = "stream_string_batch_client_handler";
+
+    static void consume(reply_type& reply, const std::string& stream, reply_sink<value_type>* sink)
+    {
+        LOG_TRACE("%s::consume(): %d values", name, reply.msg_size());
+
+        // the value strings are swapped out of the batch, the message carrying them comes back recycled from the sink
+        thread_local value_type single;
+
+        for (auto& value : *reply.mutable_msg()) {
+            LOG_DEBUG("result: %s", value.c_str());
+            if (sink) {
+                single.mutable_msg()->swap(value);
+                sink->push(stream, single);
+            }
+        }
+    }
+    static uint64_t seq(const reply_type&) { return 0; }
+    static constexpr bool sequenced = false;
+};
+
+struct stream_int_batch_client_traits
+{
+    using reply_type = proto::IntBatchReply;
+    using value_type = proto::IntReply;
+    static constexpr metric_method method = metric_method::STREAM_INT_BATCH;
+    static constexpr auto prepare = &proto::ExchangeService::Stub::PrepareAsyncStreamIntBatch;
+    static constexpr const char* name = "stream_int_batch_client_handler";
+
+    static void consume(reply_type& reply, const std::string& stream, reply_sink<value_type>* sink)
+    {
+        LOG_TRACE("%s::consume(): %d values", name, reply.msg_size());
+
+        thread_local value_type single;
+
+        for (const auto value : reply.msg()) {
+            LOG_DEBUG("result: %d", value);
+            if (sink) {
+                single.set_msg(value);
+                sink->push(stream, single);
+            }
+        }
+    }
+    static uint64_t seq(const reply_type&) { return 0; }
+    static constexpr bool sequenced = false;
+};
 
+using stream_string_batch_client_handler = stream_client_handler<stream_string_batch_client_traits>;
+using stream_int_batch_client_handler = stream_client_handler<stream_int_batch_client_traits>;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// many-to-many methods, one call serves every subscription of the client; a new one needs its traits and a
+// subscription_container in client
+
+struct bi_stream_string_client_traits
+{
+    using reply_type = proto::StringReply;
+    static constexpr metric_method method = metric_method::BI_STREAM_STRING;
+    static constexpr auto prepare = &proto::ExchangeService::Stub::PrepareAsyncBiStreamString;
+    static constexpr const char* name = "bi_stream_string_client_handler";
+
+    static void consume(reply_type& reply, const std::string& stream, reply_sink<reply_type>* sink)
+    {
+        LOG_DEBUG("result: %s", reply.msg().c_str());
+        if (sink)
+            sink->push(stream, reply);
+    }
+};
+
+struct bi_stream_int_client_traits
+{
+    using reply_type = proto::IntReply;
+    static constexpr metric_method method = metric_method::BI_STREAM_INT;
+    static constexpr auto prepare = &proto::ExchangeService::Stub::PrepareAsyncBiStreamInt;
+    static constexpr const char* name = "bi_stream_int_client_handler";
+
+    static void consume(reply_type& reply, const std::string& stream, reply_sink<reply_type>* sink)
+    {
+        LOG_DEBUG("result: %d", reply.msg());
+        if (sink)
+            sink->push(stream, reply);
+    }
+};
+
+using bi_stream_string_client_handler = bi_stream_client_handler<bi_stream_string_client_traits>;
+using bi_stream_int_client_handler = bi_stream_client_handler<bi_stream_int_client_traits>;
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+// One server stream per name. A handler is given back to the pool as soon as it reports CLOSED, whether it finished
+// or was cancelled by a newer create() for its name. A stream broken by the connection is resumed after the last
+// value it received, see resume_options.
 template <typename Handler>
-class streams_container
+class streams_container : private client_handler_owner
 {
 public:
-    streams_container(stub_ptr stub, grpc_client_queue_ptr queue) : _stub(stub), _queue(queue)
+    using sink_ptr = typename Handler::sink_ptr;
+
+    streams_container(channel_pool& channels,
+                      grpc_client_queue_ptr queue,
+                      const arena_options& arena,
+                      const call_deadlines& deadlines,
+                      const resume_options& resume) :
+        _channels(channels),
+        _queue(queue),
+        _arena(arena),
+        _deadlines(deadlines),
+        _resume(resume)
     {
-        LOG("streams_container::ctor()");
+        LOG_DEBUG("streams_container::ctor()");
     }
 
+    ~streams_container()
+    {
+        _registry.for_each([this](Handler* handler) { _pool.destroy(handler); });
+    }
+
+    streams_container(const streams_container&) = delete;
+    streams_container& operator=(const streams_container&) = delete;
+
     void create(const std::string& name, int msec)
     {
         QTimer::singleShot(msec, [this, name]() {
-            LOG("streams_container::create(name=" + name + ")");
+            LOG_DEBUG("streams_container::create(name=%s)", name.c_str());
+
+            // prepare request for new handler
+            proto::NameRequest req;
+            req.set_name(name);
+            start(req, 0);
+        });
+    }
+
+    // streams created from now on hand their values to 'sink'
+    void set_sink(sink_ptr sink) { _sink = std::move(sink); }
+    const sink_ptr& sink() const { return _sink; }
+
+    const object_pool<Handler>& pool() const { return _pool; }
+    // active names and live handlers, cancelled ones included
+    std::size_t names() const { return _registry.names(); }
+    std::size_t handlers() const { return _registry.handlers(); }
+
+    // calls made again after a broken connection
+    uint64_t resumed() const { return _resumed; }
+
+private:
+    void start(const proto::NameRequest& req, std::size_t resumes)
+    {
+        auto* handler = _pool.create(req, _channels.pick(), _queue, _arena, _deadlines);
+        handler->set_sink(_sink);
+        handler->resumes = resumes;
+
+        Handler* replaced = nullptr;
+        handler->set_owner(this, _registry.insert(req.name(), handler, replaced));
+
+        // rewrite active handler, it is reclaimed once the cancellation completes
+        if (replaced)
+            replaced->cancel();
+    }
+
+    void handler_closed(client_method_handler_stub*, std::size_t slot) override
+    {
+        LOG_TRACE("streams_container::handler_closed()");
+        auto* handler = _registry.release(slot);
+
+        // a replaced handler has lost its name to the newer call, which keeps it after the release
+        if (_resume.enabled && handler->resumable() && !_registry.find(handler->name()))
+            resume(handler->name(), handler->last_seq(), handler->resumes + 1);
+
+        _pool.destroy(handler);
+    }
+
+    void resume(const std::string& name, uint64_t seq, std::size_t attempt)
+    {
+        if (attempt > _resume.attempts) {
+            LOG_WARN("streams_container::resume(name=%s): gave up after %zu attempts", name.c_str(), _resume.attempts);
+            return;
+        }
+
+        const auto delay = static_cast<int>(_resume.backoff.count() * static_cast<int64_t>(attempt));
+        QTimer::singleShot(delay, [this, name, seq, attempt]() {
+            // create() has opened the stream again meanwhile
+            if (_registry.find(name))
+                return;
+
+            LOG_DEBUG("streams_container::resume(name=%s, seq=%lu): attempt %zu", name.c_str(), seq, attempt);
+            ++_resumed;
+
+            proto::NameRequest req;
+            req.set_name(name);
+            req.set_resume_after(seq);
+            start(req, attempt);
+        });
+    }
+
+    channel_pool& _channels;
+    grpc_client_queue_ptr _queue;
+    const arena_options _arena;
+    const call_deadlines _deadlines;
+    const resume_options _resume;
+    sink_ptr _sink;
+    uint64_t _resumed = 0;
+
+    // must outlive the handlers below
+    object_pool<Handler> _pool;
+    stream_registry<Handler> _registry;
+};
+
+// Keeps one many-to-many call open and switches it between names, a new call is opened only when the server has
+// closed the previous one.
+template <typename Handler>
+class subscription_container
+{
+public:
+    using sink_ptr = typename Handler::sink_ptr;
+
+    subscription_container(channel_pool& channels,
+                           grpc_client_queue_ptr queue,
+                           const arena_options& arena,
+                           const call_deadlines& deadlines) :
+        _channels(channels),
+        _queue(queue),
+        _arena(arena),
+        _deadlines(deadlines)
+    {
+        LOG_DEBUG("subscription_container::ctor()");
+    }
+
+    void subscribe(const std::string& name, int msec)
+    {
+        QTimer::singleShot(msec, [this, name]() {
+            LOG_DEBUG("subscription_container::subscribe(name=%s)", name.c_str());
 
             remove_old();
 
-            // prepare request for new handler
+            if (_handler && !_handler->is_writable()) {
+                _old_handlers.push_back(std::move(_handler));
+                _handler.reset();
+            }
+
+            if (!_handler) {
+                _handler = _pool.make(_channels.pick(), _queue, _arena, _deadlines);
+                _handler->set_sink(_sink);
+            }
+
             proto::NameRequest req;
             req.set_name(name);
+            _handler->write(req);
+        });
+    }
 
-            if (_handlers.count(name)) { // rewrite active handler
-                _handlers[name]->cancel();
-                _old_handlers.emplace(std::move(_handlers[name]));
+    // half-closes the call, the server finishes it after the current subscription
+    void close(int msec)
+    {
+        QTimer::singleShot(msec, [this]() {
+            LOG_DEBUG("subscription_container::close()");
 
-                _handlers[name] = std::make_unique<Handler>(req, _stub, _queue);
-            } else { // create new handler
-                _handlers.emplace(name, std::make_unique<Handler>(req, _stub, _queue));
+            if (_handler) {
+                _handler->close();
+                _old_handlers.push_back(std::move(_handler));
+                _handler.reset();
             }
         });
     }
 
+    // the running call and the ones opened later hand their replies to 'sink'
+    void set_sink(sink_ptr sink)
+    {
+        _sink = std::move(sink);
+        if (_handler)
+            _handler->set_sink(_sink);
+    }
+
+    const object_pool<Handler>& pool() const { return _pool; }
+
 private:
     void remove_old()
     {
-        LOG("streams_container::remove_old()");
+        _old_handlers.erase(std::remove_if(_old_handlers.begin(),
+                                           _old_handlers.end(),
+                                           [](const auto& handler) { return handler->is_closed(); }),
+                            _old_handlers.end());
+    }
 
-        for (auto it = _old_handlers.begin(); it != _old_handlers.end(); ++it) {
-            if ((*it)->is_closed()) {
-                LOG("streams_container::remove_old(): success");
-                _old_handlers.erase(it);
-                break;
-            }
+    channel_pool& _channels;
+    grpc_client_queue_ptr _queue;
+    const arena_options _arena;
+    const call_deadlines _deadlines;
+    sink_ptr _sink;
+
+    // must outlive the handlers below
+    object_pool<Handler> _pool;
+
+    typename object_pool<Handler>::pointer _handler;
+    std::vector<typename object_pool<Handler>::pointer> _old_handlers;
+};
+
+enum class client_mode
+{
+    POLLING, // queue polled by QTimer on the Qt thread
+    EVENT,   // queue drained by a dispatcher thread, handlers run on the Qt thread
+};
+
+struct client_options
+{
+    client_mode mode = client_mode::POLLING;
+
+    // max events handed over to the Qt thread at once in EVENT mode
+    std::size_t batch_size = 64;
+
+    // reply allocation of every handler
+    arena_options arena;
+    // per method, none by default
+    call_deadlines deadlines;
+    // broken StreamString/StreamInt calls
+    resume_options resume;
+
+    // connections the calls are spread over
+    channel_options channel;
+    // how the port given to client is dialed, IN_PROCESS clients are given the channels of their server instead
+    transport_options transport;
+};
+
+#ifdef FRANKENSTEIN_COROUTINES
+// Calls made by stream coroutines, one per name: a newer call for a name cancels the older one. Coroutines still
+// suspended when the client goes away are destroyed with it, as streams_container does with its handlers.
+class coroutine_calls
+{
+public:
+    // lives in the frame of its coroutine for the whole call
+    class call
+    {
+    public:
+        call(coroutine_calls& calls, const std::string& name, std::coroutine_handle<> handle) :
+            _calls(calls),
+            _handle(handle)
+        {
+            call* replaced = nullptr;
+            _slot = _calls._registry.insert(name, this, replaced);
+            if (replaced)
+                replaced->context.TryCancel();
         }
+        ~call() { _calls._registry.release(_slot); }
+
+        call(const call&) = delete;
+        call& operator=(const call&) = delete;
+
+        ::grpc::ClientContext context;
+
+    private:
+        friend class coroutine_calls;
+
+        coroutine_calls& _calls;
+        std::coroutine_handle<> _handle;
+        std::size_t _slot = 0;
+    };
+
+    coroutine_calls() = default;
+    ~coroutine_calls()
+    {
+        // destroying a frame releases its slot, so the handles are collected first
+        std::vector<std::coroutine_handle<>> handles;
+        _registry.for_each([&handles](call* suspended) { handles.push_back(suspended->_handle); });
+        for (auto handle : handles)
+            handle.destroy();
     }
 
-    stub_ptr _stub;
-    grpc_client_queue_ptr _queue;
+    coroutine_calls(const coroutine_calls&) = delete;
+    coroutine_calls& operator=(const coroutine_calls&) = delete;
+
+    std::size_t size() const { return _registry.handlers(); }
 
-    std::unordered_map<std::string, std::unique_ptr<Handler>> _handlers;
-    std::unordered_set<std::unique_ptr<Handler>> _old_handlers;
+private:
+    stream_registry<call> _registry;
 };
 
+// StreamInt as one coroutine, replaces stream_int_client_handler: reads every value and finishes the call. The frame
+// comes from 'frames' and is given back when the call is finished.
+coroutine_task stream_int_client_coroutine(frame_allocator& frames,
+                                           pooled_stub stub,
+                                           grpc_client_queue_ptr queue,
+                                           const call_deadlines& deadlines,
+                                           proto::NameRequest request,
+                                           std::shared_ptr<reply_sink<proto::IntReply>> sink,
+                                           coroutine_calls& calls);
+#endif
+
 class client : public QObject
 {
     Q_OBJECT
 
 public:
-    explicit client(uint16_t port);
+    // dials 'port' over TCP or the unix socket of options.transport, throws std::invalid_argument for IN_PROCESS
+    explicit client(uint16_t port, client_options options = {});
+    // the channels come from 'channels', e.g. server::in_process_channel() of a server in the same binary
+    client(channel_factory channels, client_options options);
     ~client() override;
 
     void send_ping(int msec = 1000);
     void create_stream_string(const std::string& name, int msec = 1000);
     void create_stream_int(const std::string& name, int msec = 1000);
+    void create_stream_string_batch(const std::string& name, int msec = 1000);
+    void create_stream_int_batch(const std::string& name, int msec = 1000);
+    // switch the client's BiStreamString/BiStreamInt call to 'name' without a new call setup
+    void subscribe_string(const std::string& name, int msec = 1000);
+    void subscribe_int(const std::string& name, int msec = 1000);
+    void unsubscribe(int msec = 1000);
+
+    // Replies of StreamString, StreamStringBatch (value by value) and BiStreamString go to 'sink' as well as to the
+    // log, e.g. a reply_subscription drained by a consumer thread. Applies to the calls made from now on and to the
+    // running BiStreamString call, nullptr detaches.
+    void set_reply_sink(std::shared_ptr<reply_sink<proto::StringReply>> sink);
+    // same for StreamInt, StreamIntBatch and BiStreamInt
+    void set_reply_sink(std::shared_ptr<reply_sink<proto::IntReply>> sink);
 
 private slots:
     void stop();
     void poll();
+    void dispatch();
 
 private:
-    const uint16_t _port;
+    const client_options _options;
     QTimer _timer;
 
-    stub_ptr _stub;
+    channel_pool _channels;
     grpc_client_queue_ptr _queue;
 
+    ping_client_handler::pool_type _ping_handlers;
     streams_container<stream_string_client_handler> _string_container;
     streams_container<stream_int_client_handler> _int_container;
+    streams_container<stream_string_batch_client_handler> _string_batch_container;
+    streams_container<stream_int_batch_client_handler> _int_batch_container;
+    subscription_container<bi_stream_string_client_handler> _string_subscriptions;
+    subscription_container<bi_stream_int_client_handler> _int_subscriptions;
+#ifdef FRANKENSTEIN_COROUTINES
+    // must outlive the coroutines below
+    frame_allocator _frames;
+    coroutine_calls _int_coroutines;
+#endif
+
+    std::unique_ptr<queue_dispatcher> _dispatcher;
+    std::vector<queue_dispatcher::event> _events;
 };
 
 } // namespace frankenstein
@@ -1,17 +1,21 @@
 #pragma once
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
-#include <iostream>
 
 #include <grpcpp/grpcpp.h>
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QSocketNotifier>
 
-template <typename T>
-inline static void LOG(T arg)
-{
-    std::cout << arg << std::endl;
-}
+#include <frankenstein/logging.hpp>
 
 class safe_application : public QCoreApplication
 {
@@ -22,7 +26,7 @@ class safe_application : public QCoreApplication
         try {
             return QCoreApplication::notify(receiver, event);
         } catch (std::exception& ex) {
-            LOG("Exception [" + std::string(receiver->metaObject()->className()) + "]: " + ex.what());
+            LOG_ERROR("Exception [%s]: %s", receiver->metaObject()->className(), ex.what());
             QCoreApplication::instance()->quit();
         }
 
@@ -30,14 +34,77 @@ class safe_application : public QCoreApplication
     }
 };
 
+// write end of the pipe of the signal_watcher, -1 while there is none
+inline std::atomic<int> signal_pipe{-1};
+
+// Only async-signal-safe calls: the signal number goes down the pipe, signal_watcher logs it and quits on the Qt loop.
 inline void signal_handler(int signal)
 {
-    LOG("Caught signal: " + std::to_string(signal));
-    QCoreApplication::instance()->quit();
+    const int saved_errno = errno;
+    const int fd = signal_pipe.load();
+    const auto number = static_cast<unsigned char>(signal);
+    // fails only with the pipe full of signals not read yet, one more changes nothing
+    if (fd >= 0) {
+        [[maybe_unused]] const auto written = ::write(fd, &number, 1);
+    }
+    errno = saved_errno;
 }
 
+// Reads the signals caught by signal_handler on the Qt loop, logs them and quits the application. Created after the
+// application and before signal_handler is installed.
+class signal_watcher
+{
+public:
+    signal_watcher()
+    {
+        if (::pipe(_fds) != 0) {
+            LOG_ERROR("signal_watcher::ctor(): pipe failed, signals are ignored: errno %d", errno);
+            return;
+        }
+        for (const int fd : _fds)
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        _notifier = std::make_unique<QSocketNotifier>(_fds[0], QSocketNotifier::Read);
+        QObject::connect(_notifier.get(), &QSocketNotifier::activated, [this]() { drain(); });
+        signal_pipe.store(_fds[1]);
+    }
+
+    ~signal_watcher()
+    {
+        signal_pipe.store(-1);
+        _notifier.reset();
+        for (const int fd : _fds) {
+            if (fd >= 0)
+                ::close(fd);
+        }
+    }
+
+    signal_watcher(const signal_watcher&) = delete;
+    signal_watcher& operator=(const signal_watcher&) = delete;
+
+private:
+    void drain()
+    {
+        unsigned char number;
+        while (::read(_fds[0], &number, 1) == 1)
+            LOG_INFO("Caught signal: %d", number);
+        QCoreApplication::instance()->quit();
+    }
+
+    int _fds[2] = {-1, -1};
+    std::unique_ptr<QSocketNotifier> _notifier;
+};
+
 namespace frankenstein {
 
 using grpc_status = ::grpc::Status;
 
+// wall clock in nanoseconds since the epoch, the sent_at_ns of stream messages
+inline uint64_t wall_clock_ns()
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+            .count());
+}
+
 } // namespace frankenstein
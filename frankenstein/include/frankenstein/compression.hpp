@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include <google/protobuf/message_lite.h>
+#include <grpc/compression.h>
+#include <grpcpp/server_context.h>
+#include <grpcpp/support/byte_buffer.h>
+
+#include <frankenstein/metrics.hpp>
+
+namespace frankenstein {
+
+// compression of the replies of one method
+struct method_compression
+{
+    grpc_compression_algorithm algorithm = GRPC_COMPRESS_NONE;
+    // smaller replies go out raw, the deflate framing and the cpu would cost more than the bytes saved
+    std::size_t threshold = 1024;
+};
+
+// "none", "gzip" or "deflate", returns false on anything else
+bool from_string(const std::string& name, grpc_compression_algorithm& algorithm);
+const char* to_string(grpc_compression_algorithm algorithm);
+
+struct compression_options
+{
+    // indexed by metric_method, every method replies raw unless told otherwise
+    std::array<method_compression, static_cast<std::size_t>(metric_method::COUNT)> methods{};
+    // every sample_every-th compressed reply of a queue is serialized and deflated once more on the poller thread, on
+    // top of the compression by grpc, and the savings of all the others are extrapolated from these. grpc does not
+    // report its compressed sizes, so the estimate costs cpu on the hot path and is off (zero) unless asked for.
+    std::size_t sample_every = 0;
+
+    method_compression& operator[](metric_method method) { return methods[static_cast<std::size_t>(method)]; }
+    const method_compression& operator[](metric_method method) const
+    {
+        return methods[static_cast<std::size_t>(method)];
+    }
+
+    // the methods replying text (StreamString, StreamStringBatch, BiStreamString) compress with 'algorithm', the
+    // numeric replies hardly shrink and stay raw
+    void set_text_methods(grpc_compression_algorithm algorithm, std::size_t threshold);
+    // "<method>=<algorithm>[:<threshold>]" with the method named as in the metrics, e.g. "stream_int_batch=gzip:4096",
+    // returns false on a malformed spec
+    bool set(const std::string& spec);
+    // some method compresses
+    bool enabled() const;
+};
+
+// Compression counters of one queue. Only the sampled replies are compressed by the server itself, the bytes saved
+// and the cpu spent on the rest are extrapolated from them.
+struct compression_stats
+{
+    uint64_t compressed = 0;       // replies handed to grpc for compression
+    uint64_t compressed_bytes = 0; // their size before compression
+    uint64_t raw = 0;              // replies of compressing calls that stayed below the threshold
+    uint64_t raw_bytes = 0;
+
+    uint64_t sampled = 0;
+    uint64_t sampled_bytes = 0;  // before compression
+    uint64_t sampled_output = 0; // after compression
+    uint64_t sampled_ns = 0;     // spent compressing
+
+    // estimates over all compressed replies, negative savings mean the payload does not compress
+    double saved_bytes() const;
+    double cpu_seconds() const;
+
+    void merge(const compression_stats& other);
+};
+
+// Compression of one call: the algorithm of the method is announced when the call starts, then every reply is either
+// left to grpc to compress or, below the threshold, marked to go out raw.
+class call_compression
+{
+public:
+    call_compression(const compression_options& options, metric_method method, compression_stats& stats) :
+        _method(options[method]),
+        _sample_every(options.sample_every),
+        _stats(stats)
+    {}
+
+    // must come before the first write of the call
+    void start(::grpc::ServerContext& context) const
+    {
+        if (_method.algorithm != GRPC_COMPRESS_NONE)
+            context.set_compression_algorithm(_method.algorithm);
+    }
+
+    // 'options' for writing 'reply'
+    template <typename Message>
+    ::grpc::WriteOptions write_options(const Message& reply, ::grpc::WriteOptions options = {})
+    {
+        if (_method.algorithm == GRPC_COMPRESS_NONE)
+            return options;
+
+        const auto size = message_size(reply);
+        if (size < _method.threshold) {
+            ++_stats.raw;
+            _stats.raw_bytes += size;
+            options.set_no_compression();
+            return options;
+        }
+
+        ++_stats.compressed;
+        _stats.compressed_bytes += size;
+        if (_sample_every && _stats.compressed % _sample_every == 0)
+            sample(serialize(reply));
+        return options;
+    }
+
+private:
+    static std::size_t message_size(const ::grpc::ByteBuffer& reply) { return reply.Length(); }
+    static std::size_t message_size(const google::protobuf::MessageLite& reply) { return reply.ByteSizeLong(); }
+    static std::string serialize(const ::grpc::ByteBuffer& reply);
+    static std::string serialize(const google::protobuf::MessageLite& reply) { return reply.SerializeAsString(); }
+
+    // compresses 'data' the way grpc does and records the outcome
+    void sample(const std::string& data);
+
+    const method_compression _method;
+    const std::size_t _sample_every;
+    compression_stats& _stats;
+};
+
+} // namespace frankenstein
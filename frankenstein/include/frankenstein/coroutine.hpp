@@ -0,0 +1,172 @@
+#pragma once
+
+// Coroutine handlers, built only with FRANKENSTEIN_COROUTINES (C++20).
+#ifdef FRANKENSTEIN_COROUTINES
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <utility>
+
+#include <grpcpp/alarm.h>
+#include <grpcpp/grpcpp.h>
+
+#include <frankenstein/pool.hpp>
+
+namespace frankenstein {
+
+// Return type of a handler coroutine. The coroutine starts right away, runs until its first co_await and frees its
+// frame by itself when it returns, nobody waits for it. The first parameter of every handler coroutine is the
+// frame_allocator of its queue, the frame is taken from it instead of the global heap.
+class coroutine_task
+{
+public:
+    struct promise_type
+    {
+        coroutine_task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        // handlers have no one to report to, same as an exception thrown out of proceed()
+        void unhandled_exception() noexcept { std::terminate(); }
+
+        template <typename... Args>
+        static void* operator new(std::size_t size, frame_allocator& frames, Args&...)
+        {
+            // the allocator goes in front of the frame, operator delete gets nothing else
+            auto* block = static_cast<std::byte*>(frames.allocate(size + header_size));
+            new (block) frame_allocator*(&frames);
+            return block + header_size;
+        }
+
+        static void operator delete(void* frame, std::size_t size)
+        {
+            auto* block = static_cast<std::byte*>(frame) - header_size;
+            (*reinterpret_cast<frame_allocator**>(block))->deallocate(block, size + header_size);
+        }
+
+    private:
+        static constexpr std::size_t header_size = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+    };
+};
+
+// co_await current_coroutine{} yields the handle of the calling coroutine without suspending it
+struct current_coroutine
+{
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) noexcept
+    {
+        _handle = handle;
+        return false;
+    }
+    std::coroutine_handle<> await_resume() const noexcept { return _handle; }
+
+    std::coroutine_handle<> _handle;
+};
+
+// Completion tag that resumes the coroutine waiting on it. 'Stub' is the tag type the queue poller expects
+// (server_method_handler_stub or client_method_handler_stub).
+template <typename Stub>
+class coroutine_tag : public Stub
+{
+public:
+    bool proceed(bool ok) override
+    {
+        _ok = ok;
+        // the coroutine may finish and free the frame holding this tag, nothing is touched after resume()
+        _handle.resume();
+        return true;
+    }
+
+    // the tag to hand to grpc
+    void* tag() { return static_cast<Stub*>(this); }
+
+protected:
+    std::coroutine_handle<> _handle;
+    bool _ok = false;
+};
+
+// Awaits one completion: 'start' is called with the tag once the coroutine is suspended and issues the grpc
+// operation, co_await yields the ok flag of the completion.
+template <typename Stub, typename Start>
+class tag_awaiter : public coroutine_tag<Stub>
+{
+public:
+    explicit tag_awaiter(Start start) : _start(std::move(start)) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        this->_handle = handle;
+        _start(this->tag());
+    }
+    bool await_resume() const noexcept { return this->_ok; }
+
+private:
+    Start _start;
+};
+
+// co_await on_tag<Stub>([&](void* tag) { responder.Write(reply, tag); })
+template <typename Stub, typename Start>
+tag_awaiter<Stub, Start> on_tag(Start start)
+{
+    return tag_awaiter<Stub, Start>(std::move(start));
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// wrappers of the calls the handlers make
+
+template <typename Stub, typename Responder, typename Reply>
+auto async_write(Responder& responder, const Reply& reply, ::grpc::WriteOptions options = {})
+{
+    return on_tag<Stub>([&responder, &reply, options](void* tag) { responder.Write(reply, options, tag); });
+}
+
+template <typename Stub, typename Responder, typename Reply>
+auto async_write_and_finish(Responder& responder,
+                            const Reply& reply,
+                            const ::grpc::Status& status,
+                            ::grpc::WriteOptions options = {})
+{
+    return on_tag<Stub>([&responder, &reply, &status, options](void* tag) {
+        responder.WriteAndFinish(reply, options, status, tag);
+    });
+}
+
+template <typename Stub, typename Reader, typename Reply>
+auto async_read(Reader& reader, Reply* reply)
+{
+    return on_tag<Stub>([&reader, reply](void* tag) { reader.Read(reply, tag); });
+}
+
+// server side Finish
+template <typename Stub, typename Responder>
+auto async_finish(Responder& responder, const ::grpc::Status& status)
+{
+    return on_tag<Stub>([&responder, &status](void* tag) { responder.Finish(status, tag); });
+}
+
+// client side Finish, the status of the call is written to 'status'
+template <typename Stub, typename Reader>
+auto async_finish(Reader& reader, ::grpc::Status* status)
+{
+    return on_tag<Stub>([&reader, status](void* tag) { reader.Finish(status, tag); });
+}
+
+template <typename Stub, typename Reader>
+auto async_start_call(Reader& reader)
+{
+    return on_tag<Stub>([&reader](void* tag) { reader.StartCall(tag); });
+}
+
+// resumes on 'queue' at 'deadline', false when the alarm was cancelled (queue shutdown)
+template <typename Stub, typename Deadline>
+auto async_alarm(::grpc::Alarm& alarm, ::grpc::CompletionQueue* queue, const Deadline& deadline)
+{
+    return on_tag<Stub>([&alarm, queue, deadline](void* tag) { alarm.Set(queue, deadline, tag); });
+}
+
+} // namespace frankenstein
+
+#endif // FRANKENSTEIN_COROUTINES
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <QtCore/QObject>
+
+#include <frankenstein/commons.hpp>
+
+namespace frankenstein {
+
+using grpc_queue_ptr = std::shared_ptr<::grpc::CompletionQueue>;
+
+// Blocks on CompletionQueue::Next in a dedicated thread and hands completed tags over to the Qt thread in batches.
+// ready() is emitted only when the pending batch turns non-empty, so an idle queue costs nothing.
+class queue_dispatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct event
+    {
+        void* tag;
+        bool ok;
+    };
+
+    queue_dispatcher(grpc_queue_ptr queue, std::size_t batch_size, QObject* parent = nullptr);
+    ~queue_dispatcher() override;
+
+    void start();
+    // NOTE: queue must be shut down before, otherwise blocks forever
+    void stop();
+
+    // moves all pending events into 'events'
+    void take(std::vector<event>& events);
+
+signals:
+    void ready();
+
+private:
+    void run();
+    void publish(std::vector<event>& batch);
+
+    grpc_queue_ptr _queue;
+    const std::size_t _batch_size;
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::vector<event> _pending;
+};
+
+} // namespace frankenstein
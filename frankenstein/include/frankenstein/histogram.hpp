@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+namespace frankenstein {
+
+// Log-linear histogram of non-negative integer values (latencies in nanoseconds): every power of two is split into
+// 2^SubBucketBits equal buckets, so any recorded value is reported with a relative error below 1/2^SubBucketBits.
+// 'Counter' is uint64_t for a histogram of one thread, or std::atomic<uint64_t> for one written by one thread and read
+// by any (a relaxed load and store instead of an atomic read-modify-write). Histograms of either kind merge into each
+// other when their buckets agree.
+template <typename Counter, unsigned SubBucketBits>
+class basic_histogram
+{
+public:
+    static constexpr unsigned sub_bucket_bits = SubBucketBits;
+    static constexpr std::size_t sub_buckets = std::size_t(1) << sub_bucket_bits;
+    static constexpr std::size_t bucket_count = (65 - sub_bucket_bits) * sub_buckets;
+
+    void record(uint64_t value)
+    {
+        add(_counts[index(value)], 1);
+        add(_count, 1);
+        add(_sum, value);
+        if (value < load(_min))
+            store(_min, value);
+        if (value > load(_max))
+            store(_max, value);
+    }
+
+    template <typename OtherCounter>
+    void merge(const basic_histogram<OtherCounter, SubBucketBits>& other)
+    {
+        for (std::size_t i = 0; i < bucket_count; ++i)
+            add(_counts[i], load(other._counts[i]));
+        add(_count, load(other._count));
+        add(_sum, load(other._sum));
+        store(_min, std::min(load(_min), load(other._min)));
+        store(_max, std::max(load(_max), load(other._max)));
+    }
+
+    void clear() { *this = basic_histogram(); }
+
+    uint64_t count() const { return load(_count); }
+    uint64_t min() const { return load(_count) ? load(_min) : 0; }
+    uint64_t max() const { return load(_max); }
+    double mean() const { return load(_count) ? static_cast<double>(load(_sum)) / load(_count) : 0.0; }
+
+    // p in [0, 100]
+    uint64_t percentile(double p) const
+    {
+        const auto total = load(_count);
+        if (!total)
+            return 0;
+
+        const auto rank = static_cast<uint64_t>(p / 100.0 * (total - 1)) + 1;
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucket_count; ++i) {
+            seen += load(_counts[i]);
+            if (seen >= rank)
+                return std::min(load(_max), std::max(load(_min), middle(i)));
+        }
+        return load(_max);
+    }
+
+    static std::size_t index(uint64_t value)
+    {
+        if (value < sub_buckets)
+            return static_cast<std::size_t>(value);
+
+        const unsigned msb = 63 - __builtin_clzll(value);
+        const unsigned shift = msb - sub_bucket_bits;
+        const auto mantissa = static_cast<std::size_t>(value >> shift); // in [sub_buckets, 2 * sub_buckets)
+        return (shift + 1) * sub_buckets + (mantissa - sub_buckets);
+    }
+
+    static uint64_t lower_bound(std::size_t index)
+    {
+        const std::size_t group = index >> sub_bucket_bits;
+        if (group == 0)
+            return index;
+
+        const uint64_t mantissa = sub_buckets + (index & (sub_buckets - 1));
+        return mantissa << (group - 1);
+    }
+
+    static uint64_t middle(std::size_t index)
+    {
+        const std::size_t group = index >> sub_bucket_bits;
+        return group == 0 ? index : lower_bound(index) + ((uint64_t(1) << (group - 1)) >> 1);
+    }
+
+private:
+    template <typename, unsigned>
+    friend class basic_histogram;
+
+    static uint64_t load(const uint64_t& counter) { return counter; }
+    static uint64_t load(const std::atomic<uint64_t>& counter) { return counter.load(std::memory_order_relaxed); }
+    static void store(uint64_t& counter, uint64_t value) { counter = value; }
+    static void store(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(value, std::memory_order_relaxed);
+    }
+    static void add(Counter& counter, uint64_t value) { store(counter, load(counter) + value); }
+
+    std::array<Counter, bucket_count> _counts{};
+    Counter _count{0};
+    Counter _sum{0};
+    Counter _min{std::numeric_limits<uint64_t>::max()};
+    Counter _max{0};
+};
+
+// latencies measured by one thread, e.g. a bench worker
+using latency_histogram = basic_histogram<uint64_t, 6>;
+
+} // namespace frankenstein
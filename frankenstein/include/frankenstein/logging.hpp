@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include <frankenstein/ring_buffer.hpp>
+
+// levels below this one are compiled out, see FRANKENSTEIN_LOG_LEVEL in CMakeLists.txt
+#ifndef FRANKENSTEIN_LOG_LEVEL
+#define FRANKENSTEIN_LOG_LEVEL 0
+#endif
+
+namespace frankenstein {
+
+enum class log_level : int
+{
+    TRACE = 0,
+    DEBUG = 1,
+    INFO = 2,
+    WARN = 3,
+    ERROR = 4,
+    OFF = 5
+};
+
+// Formats records printf-style straight into a preallocated ring slot on the calling thread and leaves the actual
+// output to a background writer. A record that does not fit into a full ring is dropped and counted. The writer
+// sleeps while the ring is empty and is woken by the record that finds it asleep, busy producers never notify.
+class logger
+{
+public:
+    static constexpr std::size_t record_size = 256;
+    static constexpr std::size_t ring_capacity = 4096;
+
+    static logger& instance();
+
+    static bool enabled(log_level level)
+    {
+        return static_cast<int>(level) >= _level.load(std::memory_order_relaxed);
+    }
+    static void set_level(log_level level) { _level.store(static_cast<int>(level), std::memory_order_relaxed); }
+    // accepts trace, debug, info, warn, error, off; returns false on unknown name
+    static bool set_level(const char* name);
+
+    void write(log_level level, const char* format, ...) __attribute__((format(printf, 3, 4)));
+    // blocks until everything written so far is on stdout
+    void flush();
+
+    uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    ~logger();
+
+private:
+    struct record
+    {
+        log_level level;
+        std::chrono::system_clock::time_point time;
+        char text[record_size];
+    };
+
+    logger();
+    void run();
+
+    static std::atomic<int> _level;
+
+    mpsc_ring<record> _ring;
+    std::atomic<uint64_t> _dropped{0};
+
+    std::mutex _writing;
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::atomic<bool> _sleeping{false};
+    std::atomic<bool> _stopped{false};
+    std::thread _thread;
+};
+
+} // namespace frankenstein
+
+#define FRANKENSTEIN_LOG(level, ...)                                                                                   \
+    do {                                                                                                               \
+        if constexpr (static_cast<int>(level) >= FRANKENSTEIN_LOG_LEVEL) {                                             \
+            if (::frankenstein::logger::enabled(level))                                                                \
+                ::frankenstein::logger::instance().write(level, __VA_ARGS__);                                          \
+        }                                                                                                              \
+    } while (false)
+
+#define LOG_TRACE(...) FRANKENSTEIN_LOG(::frankenstein::log_level::TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) FRANKENSTEIN_LOG(::frankenstein::log_level::DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) FRANKENSTEIN_LOG(::frankenstein::log_level::INFO, __VA_ARGS__)
+#define LOG_WARN(...) FRANKENSTEIN_LOG(::frankenstein::log_level::WARN, __VA_ARGS__)
+#define LOG_ERROR(...) FRANKENSTEIN_LOG(::frankenstein::log_level::ERROR, __VA_ARGS__)
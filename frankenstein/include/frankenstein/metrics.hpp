@@ -0,0 +1,217 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <frankenstein/histogram.hpp>
+
+namespace frankenstein {
+
+enum class metric_method : std::size_t
+{
+    PING,
+    STATS,
+    STREAM_STRING,
+    STREAM_INT,
+    STREAM_STRING_BATCH,
+    STREAM_INT_BATCH,
+    BI_STREAM_STRING,
+    BI_STREAM_INT,
+    COUNT
+};
+
+const char* to_string(metric_method method);
+
+// A client and a server may share one process (the in-process transport), each side counts its calls apart: the
+// handler states of the two sides differ even for the same method.
+enum class metric_side : std::size_t
+{
+    SERVER,
+    CLIENT,
+    COUNT
+};
+
+const char* to_string(metric_side side);
+
+// Counter written by one thread only: a relaxed load and store instead of an atomic read-modify-write.
+class metric_counter
+{
+public:
+    void add(uint64_t value = 1)
+    {
+        _value.store(_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+    uint64_t get() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> _value{0};
+};
+
+// The log-linear buckets of the bench's latency_histogram, four per power of two instead of 64 to keep the slabs small:
+// each one is a union of the bench's buckets, so the figures of Stats and of the bench line up. Written by one thread,
+// read by any; a snapshot sums them into metric_histogram_sum.
+constexpr unsigned metric_sub_bucket_bits = 2;
+using metric_histogram = basic_histogram<std::atomic<uint64_t>, metric_sub_bucket_bits>;
+using metric_histogram_sum = basic_histogram<uint64_t, metric_sub_bucket_bits>;
+
+// Metrics of one thread. Every thread writes only its own slab, so the hot path has no shared cache lines.
+struct alignas(64) metrics_slab
+{
+    static constexpr std::size_t max_states = 8;
+
+    struct method_metrics
+    {
+        metric_counter started;
+        metric_counter finished;
+        metric_counter failed;
+        metric_counter sent;
+        metric_counter received;
+        // call duration, nanoseconds
+        metric_histogram latency;
+        // time from entering a handler state to the event that leaves it, nanoseconds
+        std::array<metric_histogram, max_states> states;
+        // names of the handler states, published by the first call
+        std::atomic<const char* const*> state_names{nullptr};
+    };
+
+    struct side_metrics
+    {
+        std::array<method_metrics, static_cast<std::size_t>(metric_method::COUNT)> methods;
+        metric_counter queue_events;
+
+        method_metrics& operator[](metric_method method) { return methods[static_cast<std::size_t>(method)]; }
+    };
+
+    std::array<side_metrics, static_cast<std::size_t>(metric_side::COUNT)> sides;
+
+    side_metrics& operator[](metric_side side) { return sides[static_cast<std::size_t>(side)]; }
+};
+
+// Sum of every slab at one moment.
+struct metrics_snapshot
+{
+    struct method_type
+    {
+        uint64_t started = 0;
+        uint64_t finished = 0;
+        uint64_t failed = 0;
+        uint64_t sent = 0;
+        uint64_t received = 0;
+        metric_histogram_sum latency;
+        std::array<metric_histogram_sum, metrics_slab::max_states> states;
+        const char* const* state_names = nullptr;
+    };
+
+    struct side_type
+    {
+        std::array<method_type, static_cast<std::size_t>(metric_method::COUNT)> methods;
+        uint64_t queue_events = 0;
+
+        const method_type& operator[](metric_method method) const
+        {
+            return methods[static_cast<std::size_t>(method)];
+        }
+    };
+
+    std::chrono::steady_clock::time_point time;
+    // on the heap, the histograms are too large for the stack of the threads taking snapshots
+    std::vector<side_type> sides = std::vector<side_type>(static_cast<std::size_t>(metric_side::COUNT));
+
+    const side_type& operator[](metric_side side) const { return sides[static_cast<std::size_t>(side)]; }
+
+    // one line per active method of 'side', rates are computed against 'previous' when given
+    std::vector<std::string> to_lines(metric_side side, const metrics_snapshot* previous = nullptr) const;
+};
+
+class metrics
+{
+public:
+    // slab of the calling thread, registered on the first use and kept for the lifetime of the process
+    static metrics_slab& local()
+    {
+        thread_local metrics_slab* slab = create_slab();
+        return *slab;
+    }
+
+    static metrics_snapshot snapshot();
+
+private:
+    static metrics_slab* create_slab();
+};
+
+// Per-call bookkeeping of a handler, reported to the slab of the thread the handler runs on.
+class call_metrics
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    // state_names: null-terminated list indexed by the handler_state values of the handler
+    call_metrics(metric_side side, metric_method method, const char* const* state_names) :
+        _side(side),
+        _method(method),
+        _state_names(state_names),
+        _state_since(clock::now())
+    {}
+    ~call_metrics() { finish(); }
+
+    call_metrics(const call_metrics&) = delete;
+    call_metrics& operator=(const call_metrics&) = delete;
+
+    // the call has arrived (server) or has been issued (client)
+    void start()
+    {
+        auto& method = metrics::local()[_side][_method];
+        method.started.add();
+        if (!method.state_names.load(std::memory_order_relaxed))
+            method.state_names.store(_state_names, std::memory_order_relaxed);
+        _started = clock::now();
+        _active = true;
+    }
+
+    // the handler leaves 'state', records the time since it entered it
+    template <typename State>
+    void state_done(State state)
+    {
+        const auto now = clock::now();
+        const auto index = static_cast<std::size_t>(state);
+        if (index < metrics_slab::max_states) {
+            metrics::local()[_side][_method].states[index].record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - _state_since).count());
+        }
+        _state_since = now;
+    }
+
+    void sent() { metrics::local()[_side][_method].sent.add(); }
+    void received() { metrics::local()[_side][_method].received.add(); }
+    void fail() { _failed = true; }
+
+    // counted once, the destructor finishes a call that is still active
+    void finish()
+    {
+        if (!_active)
+            return;
+
+        _active = false;
+        auto& method = metrics::local()[_side][_method];
+        method.finished.add();
+        if (_failed)
+            method.failed.add();
+        method.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - _started).count());
+    }
+
+private:
+    const metric_side _side;
+    const metric_method _method;
+    const char* const* _state_names;
+
+    clock::time_point _started;
+    clock::time_point _state_since;
+    bool _active = false;
+    bool _failed = false;
+};
+
+} // namespace frankenstein
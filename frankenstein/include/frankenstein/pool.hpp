@@ -0,0 +1,199 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace frankenstein {
+
+namespace detail {
+
+// counters of the pools have a single writer, no need for an atomic read-modify-write
+template <typename Counter>
+void increment(std::atomic<Counter>& counter)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+template <typename Counter>
+void decrement(std::atomic<Counter>& counter)
+{
+    counter.store(counter.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+}
+
+} // namespace detail
+
+// Free list of storage blocks for objects of one type. An object is still constructed and destroyed on every
+// create/destroy (grpc contexts are single-use), only the memory is recycled. Not thread-safe: one pool belongs to
+// one completion queue and is used only by the thread draining it. Counters may be read from any thread.
+template <typename T>
+class object_pool
+{
+public:
+    struct deleter
+    {
+        object_pool* pool;
+        void operator()(T* object) const { pool->destroy(object); }
+    };
+
+    using pointer = std::unique_ptr<T, deleter>;
+
+    explicit object_pool(std::size_t capacity = 1024) : _capacity(capacity) { _free.reserve(_capacity); }
+    ~object_pool();
+
+    object_pool(const object_pool&) = delete;
+    object_pool& operator=(const object_pool&) = delete;
+    object_pool(object_pool&&) = delete;
+    object_pool& operator=(object_pool&&) = delete;
+
+    template <typename... Args>
+    T* create(Args&&... args);
+    template <typename... Args>
+    pointer make(Args&&... args) { return pointer(create(std::forward<Args>(args)...), deleter{this}); }
+
+    void destroy(T* object);
+
+    uint64_t hits() const { return _hits.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return _misses.load(std::memory_order_relaxed); }
+    std::size_t cached() const { return _cached.load(std::memory_order_relaxed); }
+    // objects created and not destroyed yet
+    std::size_t live() const { return _live.load(std::memory_order_relaxed); }
+
+private:
+    const std::size_t _capacity;
+    std::vector<void*> _free;
+
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _misses{0};
+    std::atomic<std::size_t> _cached{0};
+    std::atomic<std::size_t> _live{0};
+};
+
+template <typename T>
+object_pool<T>::~object_pool()
+{
+    for (void* block : _free)
+        ::operator delete(block);
+}
+
+template <typename T>
+template <typename... Args>
+T* object_pool<T>::create(Args&&... args)
+{
+    void* block = nullptr;
+    if (!_free.empty()) {
+        block = _free.back();
+        _free.pop_back();
+        _cached.store(_free.size(), std::memory_order_relaxed);
+        detail::increment(_hits);
+    } else {
+        block = ::operator new(sizeof(T));
+        detail::increment(_misses);
+    }
+
+    try {
+        auto* object = new (block) T(std::forward<Args>(args)...);
+        detail::increment(_live);
+        return object;
+    } catch (...) {
+        _free.push_back(block);
+        _cached.store(_free.size(), std::memory_order_relaxed);
+        throw;
+    }
+}
+
+template <typename T>
+void object_pool<T>::destroy(T* object)
+{
+    if (!object)
+        return;
+
+    object->~T();
+    detail::decrement(_live);
+
+    if (_free.size() < _capacity) {
+        _free.push_back(object);
+        _cached.store(_free.size(), std::memory_order_relaxed);
+    } else {
+        ::operator delete(object);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Storage of coroutine frames, recycled by size class. All frames of one coroutine have the same size, so a steady
+// stream of calls stops allocating after warm-up. Frames above max_pooled go straight to the heap. Not thread-safe:
+// one allocator belongs to one completion queue, like object_pool. Counters may be read from any thread.
+class frame_allocator
+{
+public:
+    static constexpr std::size_t granularity = 64;
+    static constexpr std::size_t max_pooled = 4096;
+
+    explicit frame_allocator(std::size_t capacity = 1024) : _capacity(capacity) {}
+    ~frame_allocator()
+    {
+        for (auto& blocks : _free) {
+            for (void* block : blocks)
+                ::operator delete(block);
+        }
+    }
+
+    frame_allocator(const frame_allocator&) = delete;
+    frame_allocator& operator=(const frame_allocator&) = delete;
+
+    void* allocate(std::size_t size)
+    {
+        detail::increment(_live);
+        if (size > max_pooled) {
+            detail::increment(_misses);
+            return ::operator new(size);
+        }
+
+        auto& blocks = _free[size_class(size)];
+        if (blocks.empty()) {
+            detail::increment(_misses);
+            return ::operator new((size_class(size) + 1) * granularity);
+        }
+
+        detail::increment(_hits);
+        void* block = blocks.back();
+        blocks.pop_back();
+        return block;
+    }
+
+    // 'size' must be the one given to allocate()
+    void deallocate(void* block, std::size_t size)
+    {
+        detail::decrement(_live);
+        if (size > max_pooled) {
+            ::operator delete(block);
+            return;
+        }
+
+        auto& blocks = _free[size_class(size)];
+        if (blocks.size() < _capacity)
+            blocks.push_back(block);
+        else
+            ::operator delete(block);
+    }
+
+    uint64_t hits() const { return _hits.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return _misses.load(std::memory_order_relaxed); }
+    // frames allocated and not given back yet, i.e. running coroutines
+    std::size_t live() const { return _live.load(std::memory_order_relaxed); }
+
+private:
+    static std::size_t size_class(std::size_t size) { return size ? (size - 1) / granularity : 0; }
+
+    const std::size_t _capacity;
+    std::array<std::vector<void*>, max_pooled / granularity> _free;
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _misses{0};
+    std::atomic<std::size_t> _live{0};
+};
+
+} // namespace frankenstein
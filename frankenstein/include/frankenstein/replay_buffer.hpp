@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace frankenstein {
+
+// The last 'capacity' messages of one stream, addressed by their sequence numbers, which increase by one from message
+// to message. The slots are allocated once and overwritten in place: slot = seq % capacity, so the buffer needs no
+// index besides the newest sequence number. A zero capacity keeps nothing. Not thread-safe: one buffer per topic.
+template <typename T>
+class replay_buffer
+{
+public:
+    explicit replay_buffer(std::size_t capacity) : _slots(capacity) {}
+
+    replay_buffer(const replay_buffer&) = delete;
+    replay_buffer& operator=(const replay_buffer&) = delete;
+
+    // 'seq' follows the newest one, the oldest message goes once the buffer is full
+    void push(uint64_t seq, T value)
+    {
+        if (_slots.empty())
+            return;
+
+        _slots[seq % _slots.size()] = std::move(value);
+        _last = seq;
+        if (_size < _slots.size())
+            ++_size;
+    }
+
+    // sequence numbers of the oldest and the newest message kept, zero when empty
+    uint64_t first_seq() const { return _size ? _last - _size + 1 : 0; }
+    uint64_t last_seq() const { return _size ? _last : 0; }
+
+    // visit(seq, const T&) for every message kept after 'seq' from the oldest one on, returns how many were visited
+    template <typename Visit>
+    std::size_t for_each_after(uint64_t seq, Visit&& visit) const
+    {
+        if (!_size || seq >= _last)
+            return 0;
+
+        const auto from = std::max(seq + 1, first_seq());
+        for (auto current = from; current <= _last; ++current)
+            visit(current, static_cast<const T&>(_slots[current % _slots.size()]));
+        return static_cast<std::size_t>(_last - from + 1);
+    }
+
+    std::size_t capacity() const { return _slots.size(); }
+    std::size_t size() const { return _size; }
+
+private:
+    std::vector<T> _slots;
+    std::size_t _size = 0;
+    uint64_t _last = 0;
+};
+
+} // namespace frankenstein
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <grpcpp/impl/codegen/proto_utils.h>
+#include <grpcpp/support/byte_buffer.h>
+
+namespace frankenstein {
+
+struct reply_cache_stats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0; // replies encoded
+    uint64_t evicted = 0;
+};
+
+// Replies already encoded for the wire, keyed by content (or by whatever names the producer of the reply) and
+// version. A hit returns a copy of the cached ByteBuffer, which shares its slices instead of copying the bytes, so
+// raw-buffer handlers write it without touching protobuf. The least recently used entry goes when the cache is full.
+// Not thread-safe: one cache per completion queue.
+class reply_cache
+{
+public:
+    explicit reply_cache(std::size_t capacity = 256) : _capacity(capacity) {}
+
+    reply_cache(const reply_cache&) = delete;
+    reply_cache& operator=(const reply_cache&) = delete;
+
+    // the reply stored under 'key', 'fill' builds it into a fresh Reply on a miss or when 'version' differs from the
+    // cached one; a zero capacity encodes every time
+    template <typename Reply, typename Fill>
+    ::grpc::ByteBuffer get(const std::string& key, uint64_t version, Fill&& fill)
+    {
+        const auto found = _index.find(key);
+        if (found != _index.end() && found->second->version == version) {
+            ++stats.hits;
+            // most recently used goes to the front
+            _entries.splice(_entries.begin(), _entries, found->second);
+            return found->second->buffer;
+        }
+
+        ++stats.misses;
+        Reply reply;
+        fill(reply);
+        ::grpc::ByteBuffer buffer;
+        bool own_buffer = false;
+        ::grpc::SerializationTraits<Reply>::Serialize(reply, &buffer, &own_buffer);
+
+        if (found != _index.end()) {
+            found->second->version = version;
+            found->second->buffer = buffer;
+            _entries.splice(_entries.begin(), _entries, found->second);
+        } else if (_capacity) {
+            if (_entries.size() == _capacity)
+                evict();
+            _entries.push_front({key, version, buffer});
+            _index.emplace(key, _entries.begin());
+        }
+
+        return buffer;
+    }
+
+    // drops the least recently used entries above the new capacity
+    void set_capacity(std::size_t capacity)
+    {
+        _capacity = capacity;
+        while (_entries.size() > _capacity)
+            evict();
+    }
+
+    std::size_t size() const { return _entries.size(); }
+
+    reply_cache_stats stats;
+
+private:
+    struct entry_type
+    {
+        std::string key;
+        uint64_t version;
+        ::grpc::ByteBuffer buffer;
+    };
+
+    void evict()
+    {
+        _index.erase(_entries.back().key);
+        _entries.pop_back();
+        ++stats.evicted;
+    }
+
+    std::size_t _capacity;
+    std::list<entry_type> _entries;
+    std::unordered_map<std::string, std::list<entry_type>::iterator> _index;
+};
+
+// Encoded 'reply' with its uint64 fields 'first' and 'second' set, each a field number and a value, e.g. the sequence
+// number and the send time of a cached stream update. The fields are encoded on their own into one more slice, the
+// slices of 'reply' are shared and not copied: protobuf parses fields appended this way as if they were in place.
+// 'slices' is scratch space reused between calls.
+inline ::grpc::ByteBuffer append_uint64_fields(const ::grpc::ByteBuffer& reply,
+                                               std::pair<uint32_t, uint64_t> first,
+                                               std::pair<uint32_t, uint64_t> second,
+                                               std::vector<::grpc::Slice>& slices)
+{
+    using coded_output = google::protobuf::io::CodedOutputStream;
+
+    // two tags and varints, at most 22 bytes: small enough for a slice inlined without allocation
+    uint8_t field[32];
+    auto* end = coded_output::WriteVarint32ToArray(first.first << 3, field);
+    end = coded_output::WriteVarint64ToArray(first.second, end);
+    end = coded_output::WriteVarint32ToArray(second.first << 3, end);
+    end = coded_output::WriteVarint64ToArray(second.second, end);
+
+    slices.clear();
+    reply.Dump(&slices);
+    slices.emplace_back(field, static_cast<std::size_t>(end - field));
+    return ::grpc::ByteBuffer(slices.data(), slices.size());
+}
+
+} // namespace frankenstein
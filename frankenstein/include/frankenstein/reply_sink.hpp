@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <frankenstein/ring_buffer.hpp>
+
+namespace frankenstein {
+
+// One reply of a stream together with the name it was requested for. For BiStreamString/BiStreamInt the name is the
+// one the call was switched to last when the reply arrived.
+template <typename Reply>
+struct reply_value
+{
+    std::string name;
+    Reply reply;
+};
+
+// Where the client hands the replies of its streams, called on the thread the client handlers run on. 'reply' is
+// swapped into the sink and comes back holding a recycled message, whatever it holds is cleared before the next read.
+template <typename Reply>
+class reply_sink
+{
+public:
+    virtual ~reply_sink() = default;
+    virtual void push(const std::string& name, Reply& reply) = 0;
+};
+
+// Replies handed over to a consumer thread through a bounded lock-free ring. The messages are swapped into slots
+// allocated up front and read in place by drain(), so after warm-up neither side copies a payload or allocates. A full
+// ring drops the newest reply and counts it, the client never waits for its consumer.
+// 'Ring' is spsc_ring when one client feeds the subscription, mpsc_ring when clients on several threads share it.
+template <typename Reply, template <typename> class Ring = spsc_ring>
+class reply_subscription final : public reply_sink<Reply>
+{
+public:
+    using value_type = reply_value<Reply>;
+
+    explicit reply_subscription(std::size_t capacity) : _ring(capacity) {}
+
+    reply_subscription(const reply_subscription&) = delete;
+    reply_subscription& operator=(const reply_subscription&) = delete;
+
+    void push(const std::string& name, Reply& reply) override
+    {
+        const bool pushed = _ring.try_produce([&name, &reply](value_type& slot) {
+            slot.name.assign(name);
+            slot.reply.Swap(&reply);
+        });
+        (pushed ? _delivered : _dropped).fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // consumer thread: consume(const value_type&) for at most 'max' replies, a view into the slot that is valid until
+    // consume returns; returns how many were taken
+    template <typename Consume>
+    std::size_t drain(Consume&& consume, std::size_t max = static_cast<std::size_t>(-1))
+    {
+        return _ring.consume([&consume](value_type& slot) { consume(static_cast<const value_type&>(slot)); }, max);
+    }
+
+    // consumer thread: takes one reply out, 'value' gives its buffers to the slot in exchange
+    bool try_pop(value_type& value)
+    {
+        return _ring.consume(
+                   [&value](value_type& slot) {
+                       value.name.swap(slot.name);
+                       value.reply.Swap(&slot.reply);
+                   },
+                   1) == 1;
+    }
+
+    std::size_t capacity() const { return _ring.capacity(); }
+    // approximate
+    std::size_t size() const { return _ring.size(); }
+
+    uint64_t delivered() const { return _delivered.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+    Ring<value_type> _ring;
+
+    std::atomic<uint64_t> _delivered{0};
+    std::atomic<uint64_t> _dropped{0};
+};
+
+} // namespace frankenstein
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace frankenstein {
+
+namespace detail {
+
+inline std::size_t ring_capacity(std::size_t value)
+{
+    std::size_t result = 2;
+    while (result < value)
+        result <<= 1;
+    return result;
+}
+
+} // namespace detail
+
+// Bounded lock-free queue for many producers and one consumer (D. Vyukov's sequence-numbered ring).
+// Slots are allocated once and reused, producers fill a slot in place and never wait for each other or for the
+// consumer: a push into a full ring fails instead.
+template <typename T>
+class mpsc_ring
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit mpsc_ring(std::size_t capacity);
+
+    mpsc_ring(const mpsc_ring&) = delete;
+    mpsc_ring& operator=(const mpsc_ring&) = delete;
+
+    // fill(T&) writes the element in place, not called when the ring is full
+    template <typename Fill>
+    bool try_produce(Fill&& fill);
+    bool try_push(T value)
+    {
+        return try_produce([&value](T& slot) { slot = std::move(value); });
+    }
+
+    // consumer side only; consume(T&) is called for at most 'max' elements, returns how many were taken
+    template <typename Consume>
+    std::size_t consume(Consume&& consume, std::size_t max = static_cast<std::size_t>(-1));
+    bool try_pop(T& value)
+    {
+        return consume([&value](T& slot) { value = std::move(slot); }, 1) == 1;
+    }
+
+    std::size_t capacity() const { return _mask + 1; }
+    // approximate, exact only when called by the consumer with no concurrent producers
+    std::size_t size() const
+    {
+        const std::size_t head = _head.load(std::memory_order_relaxed);
+        return _tail.load(std::memory_order_relaxed) - head;
+    }
+
+private:
+    struct cell
+    {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    const std::size_t _mask;
+    std::unique_ptr<cell[]> _cells;
+
+    // producers and consumer never share a cache line
+    alignas(64) std::atomic<std::size_t> _tail{0};
+    alignas(64) std::atomic<std::size_t> _head{0};
+};
+
+template <typename T>
+mpsc_ring<T>::mpsc_ring(std::size_t capacity) :
+    _mask(detail::ring_capacity(capacity) - 1),
+    _cells(new cell[_mask + 1])
+{
+    for (std::size_t i = 0; i <= _mask; ++i)
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template <typename T>
+template <typename Fill>
+bool mpsc_ring<T>::try_produce(Fill&& fill)
+{
+    std::size_t pos = _tail.load(std::memory_order_relaxed);
+    cell* target = nullptr;
+
+    for (;;) {
+        target = &_cells[pos & _mask];
+        const std::size_t sequence = target->sequence.load(std::memory_order_acquire);
+        const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+
+        if (diff == 0) {
+            if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false; // full
+        } else {
+            pos = _tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    fill(target->value);
+    target->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+template <typename Consume>
+std::size_t mpsc_ring<T>::consume(Consume&& consume, std::size_t max)
+{
+    std::size_t pos = _head.load(std::memory_order_relaxed);
+    std::size_t taken = 0;
+
+    while (taken < max) {
+        cell& target = _cells[pos & _mask];
+        if (target.sequence.load(std::memory_order_acquire) != pos + 1)
+            break; // empty or the producer has not finished filling yet
+
+        consume(target.value);
+        target.sequence.store(pos + _mask + 1, std::memory_order_release);
+        ++pos;
+        ++taken;
+    }
+
+    _head.store(pos, std::memory_order_relaxed);
+    return taken;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+// Bounded lock-free queue for one producer and one consumer, same interface as mpsc_ring. Each index is written by one
+// side only, so a slot is claimed without a compare-and-swap and each side reads the index of the other only when its
+// cached copy says the ring is full (producer) or empty (consumer).
+template <typename T>
+class spsc_ring
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit spsc_ring(std::size_t capacity) :
+        _mask(detail::ring_capacity(capacity) - 1),
+        _values(new T[_mask + 1])
+    {}
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    // producer side only; fill(T&) writes the element in place, not called when the ring is full
+    template <typename Fill>
+    bool try_produce(Fill&& fill);
+    bool try_push(T value)
+    {
+        return try_produce([&value](T& slot) { slot = std::move(value); });
+    }
+
+    // consumer side only; consume(T&) is called for at most 'max' elements, the slots are given back to the producer
+    // once all of them are consumed
+    template <typename Consume>
+    std::size_t consume(Consume&& consume, std::size_t max = static_cast<std::size_t>(-1));
+    bool try_pop(T& value)
+    {
+        return consume([&value](T& slot) { value = std::move(slot); }, 1) == 1;
+    }
+
+    std::size_t capacity() const { return _mask + 1; }
+    // approximate, exact only when called by either side with the other one idle
+    std::size_t size() const
+    {
+        const std::size_t head = _head.load(std::memory_order_relaxed);
+        return _tail.load(std::memory_order_relaxed) - head;
+    }
+
+private:
+    const std::size_t _mask;
+    std::unique_ptr<T[]> _values;
+
+    // producer line: its index and the last head it has seen
+    alignas(64) std::atomic<std::size_t> _tail{0};
+    std::size_t _head_cache = 0;
+    // consumer line: its index and the last tail it has seen
+    alignas(64) std::atomic<std::size_t> _head{0};
+    std::size_t _tail_cache = 0;
+};
+
+template <typename T>
+template <typename Fill>
+bool spsc_ring<T>::try_produce(Fill&& fill)
+{
+    const std::size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head_cache > _mask) {
+        _head_cache = _head.load(std::memory_order_acquire);
+        if (tail - _head_cache > _mask)
+            return false; // full
+    }
+
+    fill(_values[tail & _mask]);
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+template <typename Consume>
+std::size_t spsc_ring<T>::consume(Consume&& consume, std::size_t max)
+{
+    std::size_t head = _head.load(std::memory_order_relaxed);
+    std::size_t taken = 0;
+
+    while (taken < max) {
+        if (head == _tail_cache) {
+            _tail_cache = _tail.load(std::memory_order_acquire);
+            if (head == _tail_cache)
+                break; // empty
+        }
+
+        consume(_values[head & _mask]);
+        ++head;
+        ++taken;
+    }
+
+    if (taken)
+        _head.store(head, std::memory_order_release);
+    return taken;
+}
+
+} // namespace frankenstein
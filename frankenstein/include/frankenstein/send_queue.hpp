@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace frankenstein {
+
+enum class overflow_policy
+{
+    BLOCK,       // a full queue refuses new values, the producer pauses until a write frees a slot
+    DROP_OLDEST, // a full queue drops its oldest value
+    CONFLATE,    // a value replaces the queued one with the same key, a full queue drops its oldest value
+};
+
+// returns false on unknown name
+bool from_string(const std::string& name, overflow_policy& policy);
+
+struct send_queue_options
+{
+    overflow_policy policy = overflow_policy::BLOCK;
+    std::size_t capacity = 64;
+};
+
+// Counters shared by the send queues of one completion queue, only its thread updates them.
+struct send_queue_stats
+{
+    uint64_t pushed = 0;
+    uint64_t dropped = 0;
+    uint64_t conflated = 0;
+    uint64_t depth = 0;     // values queued right now over all streams
+    uint64_t max_depth = 0; // deepest single queue seen
+};
+
+// Bounded outbound queue of one stream. Slots are allocated once and values are swapped in and out, so a steady
+// stream does not allocate.
+template <typename T>
+class send_queue
+{
+public:
+    send_queue(const send_queue_options& options, send_queue_stats& stats) :
+        _policy(options.policy),
+        _slots(std::max<std::size_t>(1, options.capacity)),
+        _stats(stats)
+    {}
+
+    ~send_queue() { _stats.depth -= _size; }
+
+    send_queue(const send_queue&) = delete;
+    send_queue& operator=(const send_queue&) = delete;
+
+    bool empty() const { return _size == 0; }
+    bool full() const { return _size == _slots.size(); }
+    std::size_t size() const { return _size; }
+
+    // false only for BLOCK on a full queue, 'value' is left untouched then
+    bool push(const std::string& key, T&& value)
+    {
+        if (_policy == overflow_policy::CONFLATE) {
+            for (std::size_t i = 0; i < _size; ++i) {
+                auto& slot = at(i);
+                if (slot.key == key) {
+                    std::swap(slot.value, value);
+                    ++_stats.conflated;
+                    return true;
+                }
+            }
+        }
+
+        if (full()) {
+            if (_policy == overflow_policy::BLOCK)
+                return false;
+            pop();
+            ++_stats.dropped;
+        }
+
+        auto& slot = at(_size);
+        slot.key = key;
+        std::swap(slot.value, value);
+        ++_size;
+
+        ++_stats.pushed;
+        ++_stats.depth;
+        _stats.max_depth = std::max<uint64_t>(_stats.max_depth, _size);
+        return true;
+    }
+
+    T& front() { return at(0).value; }
+
+    void pop()
+    {
+        _head = (_head + 1) % _slots.size();
+        --_size;
+        --_stats.depth;
+    }
+
+private:
+    struct slot_type
+    {
+        std::string key;
+        T value;
+    };
+
+    slot_type& at(std::size_t i) { return _slots[(_head + i) % _slots.size()]; }
+
+    const overflow_policy _policy;
+    std::vector<slot_type> _slots;
+    std::size_t _head = 0;
+    std::size_t _size = 0;
+
+    send_queue_stats& _stats;
+};
+
+} // namespace frankenstein
@@ -1,15 +1,33 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
-// #include <grpcpp/alarm.h>
+#include <grpcpp/alarm.h>
 
 #include <QtCore/QObject>
 #include <QtCore/QTimer>
 
 #include <proto/exchange_service.grpc.pb.h>
 
+#include <frankenstein/admission.hpp>
+#include <frankenstein/arena.hpp>
 #include <frankenstein/commons.hpp>
+#include <frankenstein/compression.hpp>
+#include <frankenstein/coroutine.hpp>
+#include <frankenstein/dispatcher.hpp>
+#include <frankenstein/metrics.hpp>
+#include <frankenstein/pool.hpp>
+#include <frankenstein/replay_buffer.hpp>
+#include <frankenstein/reply_cache.hpp>
+#include <frankenstein/send_queue.hpp>
+#include <frankenstein/transport.hpp>
 
 namespace frankenstein {
 
@@ -17,48 +35,295 @@ using grpc_server_ptr = std::unique_ptr<::grpc::Server>;
 using grpc_server_queue_ptr = std::shared_ptr<::grpc::ServerCompletionQueue>;
 using grpc_server_context = ::grpc::ServerContext;
 
-using async_service = proto::ExchangeService::AsyncService;
-using async_service_ptr = std::shared_ptr<proto::ExchangeService::AsyncService>;
+// Ping and StreamString are served raw: their replies are encoded once and written as ready ByteBuffers
+using async_service = proto::ExchangeService::WithRawMethod_Ping<
+    proto::ExchangeService::WithRawMethod_StreamString<proto::ExchangeService::AsyncService>>;
+using async_service_ptr = std::shared_ptr<async_service>;
 
 template <class T>
 using server_async_writer = ::grpc::ServerAsyncWriter<T>;
 template <class T>
 using server_async_response_writer = ::grpc::ServerAsyncResponseWriter<T>;
+template <class W, class R>
+using server_async_reader_writer = ::grpc::ServerAsyncReaderWriter<W, R>;
 
 // ---------------------------------------------------------------------------------------------------------------------
 
+enum class server_mode
+{
+    POLLING,  // single queue polled by QTimer on the Qt thread
+    EVENT,    // single queue drained by a dispatcher thread, handlers run on the Qt thread
+    THREADED, // N queues, each drained by its own thread
+};
+
+// returns false on unknown name
+bool from_string(const std::string& name, server_mode& mode);
+
+enum class server_engine
+{
+    QUEUE,    // hand-written handlers on completion queues, dispatched as the server_mode says
+    CALLBACK, // reactors of the callback API on the threads of grpc, server_mode does not apply
+};
+
+const char* to_string(server_engine engine);
+// returns false on unknown name
+bool from_string(const std::string& name, server_engine& engine);
+
+struct server_options
+{
+    server_engine engine = server_engine::QUEUE;
+    server_mode mode = server_mode::POLLING;
+    // IN_PROCESS opens no port, clients take their channels from in_process_channel()
+    transport_options transport;
+    // SO_REUSEPORT on the TCP port: the next process of a hot restart binds it while this one is still draining
+    bool reuse_port = true;
+    // stop() waits this long for calls in flight, the rest is cancelled
+    std::chrono::milliseconds drain_timeout{5000};
+
+    // number of completion queues in THREADED mode, 0 means one per hardware thread
+    std::size_t queues = 1;
+    // pin poller thread i to cpu (i % hardware threads)
+    bool pin_threads = false;
+    // max events handed over to the Qt thread at once in EVENT mode
+    std::size_t batch_size = 64;
+
+    // delay between two consecutive messages of one stream, zero writes back-to-back
+    std::chrono::microseconds stream_interval{10000};
+    // values sent by one stream before it is finished
+    std::size_t stream_length = 5;
+    // batched streams produce values at stream_interval and write them once this many are pending or the oldest
+    // pending one waited for stream_batch_delay
+    std::size_t stream_batch_size = 64;
+    std::chrono::microseconds stream_batch_delay{5000};
+
+    // request/reply allocation, the arena of a call is released together with its handler
+    arena_options arena;
+
+    // outbound queue of every bidirectional stream and topic subscriber, BLOCK drops for subscribers: a topic does not
+    // wait for its slowest client
+    send_queue_options send_queue;
+
+    // encoded replies kept per queue for constant and repeated payloads, zero encodes every reply
+    std::size_t reply_cache_size = 256;
+
+    // StreamString updates kept per topic for subscribers that resume a broken call, zero keeps none. A topic whose
+    // last subscriber broke off keeps publishing for replay_linger, so the updates of a short outage are replayed.
+    std::size_t replay_size = 64;
+    std::chrono::milliseconds replay_linger{5000};
+
+    // algorithm and size threshold of the replies of every method, applied by the queue engine
+    compression_options compression;
+
+    // limits on the calls and streams of one name or client, all off by default
+    admission_options admission;
+
+    // period of the metrics dump to the log, zero disables it
+    std::chrono::milliseconds metrics_interval{0};
+};
+
+class ping_server_handler;
+class stats_server_handler;
+class stream_string_server_handler;
+template <typename Traits>
+class stream_server_handler;
+struct stream_int_server_traits;
+struct stream_string_batch_server_traits;
+struct stream_int_batch_server_traits;
+using stream_int_server_handler = stream_server_handler<stream_int_server_traits>;
+using stream_string_batch_server_handler = stream_server_handler<stream_string_batch_server_traits>;
+using stream_int_batch_server_handler = stream_server_handler<stream_int_batch_server_traits>;
+template <typename Traits>
+class bi_stream_server_handler;
+struct bi_stream_string_server_traits;
+struct bi_stream_int_server_traits;
+using bi_stream_string_server_handler = bi_stream_server_handler<bi_stream_string_server_traits>;
+using bi_stream_int_server_handler = bi_stream_server_handler<bi_stream_int_server_traits>;
+struct server_shard;
+class callback_service;
+
+class server_method_handler_stub
+{
+public:
+    virtual bool proceed(bool ok) = 0;
+    virtual ~server_method_handler_stub() = default;
+
+protected:
+    // returns handler to the pool of its shard, must be the last thing a handler does
+    virtual void release() = 0;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// topics
+
+// Values of one name shared by all of its StreamString subscribers on a queue. Every update is taken encoded from the
+// reply cache of the shard, stamped with its sequence number and the same ref-counted ByteBuffer is queued to each
+// subscriber and kept for replay. The topic paces itself on its own alarm and goes away at the first tick without
+// subscribers, or after replay_linger when the last one broke off.
+class topic : public server_method_handler_stub
+{
+public:
+    topic(server_shard* shard, std::string name);
+
+    // 'resume_after' is the last seq seen by a broken call of the subscriber, the updates after it are replayed
+    void subscribe(stream_string_server_handler* subscriber, uint64_t resume_after = 0);
+    // 'broken': the call was cancelled or failed and may come back to resume
+    void unsubscribe(stream_string_server_handler* subscriber, bool broken);
+
+    // alarm: publishes the next update
+    bool proceed(bool ok) override;
+
+protected:
+    void release() override;
+
+private:
+    struct replay_entry
+    {
+        ::grpc::ByteBuffer update;
+        bool last = false;
+    };
+
+    void schedule();
+    void replay(stream_string_server_handler* subscriber, uint64_t resume_after);
+
+    server_shard* _shard;
+    const std::string _name;
+    std::vector<stream_string_server_handler*> _subscribers;
+
+    // values count down from stream_length to 1 and start over, a subscriber gets the rest of the current round
+    std::size_t _value;
+
+    // The sequence numbers start at the creation time of the topic in microseconds and grow by one per update, far
+    // slower than the clock. A call resuming on another queue or on a restarted server thus finds a history that cannot
+    // hold its resume point, instead of another stream under the same numbers.
+    const uint64_t _first_seq;
+    uint64_t _next_seq;
+    replay_buffer<replay_entry> _history;
+    std::vector<::grpc::Slice> _slices;
+    std::chrono::system_clock::time_point _linger_until;
+
+    // holds the updates back on top of the pacing
+    token_bucket _rate;
+
+    ::grpc::Alarm _alarm;
+    bool _alarm_set = false;
+    std::chrono::system_clock::time_point _next_update;
+};
+
+struct replay_stats
+{
+    uint64_t resumed = 0;  // subscribers that came with a resume point
+    uint64_t replayed = 0; // updates queued to them from the history
+    uint64_t missed = 0;   // updates they had not seen and the history no longer held
+    uint64_t foreign = 0;  // resume points outside of the history of the topic, the subscriber started live
+};
+
+class topic_registry
+{
+public:
+    topic& find_or_create(server_shard* shard, const std::string& name);
+    void erase(const std::string& name);
+    std::size_t size() const { return _topics.size(); }
+    // same, may be read from any thread
+    std::size_t live() const { return _live.load(std::memory_order_relaxed); }
+
+    // updates queued to subscribers and resumed subscribers, only the thread of the queue updates them
+    uint64_t published = 0;
+    replay_stats replay;
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<topic>> _topics;
+    std::atomic<std::size_t> _live{0};
+};
+
+// what every handler of one completion queue shares
+struct server_shard
+{
+    std::size_t index;
+    async_service_ptr service;
+    grpc_server_queue_ptr queue;
+    server_options options;
+
+    // finished handlers give their storage back here, the next call on this queue reuses it
+    object_pool<ping_server_handler> ping_handlers;
+    object_pool<stats_server_handler> stats_handlers;
+    object_pool<stream_string_server_handler> stream_string_handlers;
+    object_pool<stream_int_server_handler> stream_int_handlers;
+    object_pool<stream_string_batch_server_handler> stream_string_batch_handlers;
+    object_pool<stream_int_batch_server_handler> stream_int_batch_handlers;
+    object_pool<bi_stream_string_server_handler> bi_stream_string_handlers;
+    object_pool<bi_stream_int_server_handler> bi_stream_int_handlers;
+
+    send_queue_stats send_queues;
+    compression_stats compression;
+    topic_registry topics;
+    reply_cache replies;
+    // the same one for every queue of the server
+    std::shared_ptr<admission_control> admission;
+#ifdef FRANKENSTEIN_COROUTINES
+    frame_allocator frames;
+#endif
+
+    // set once the server has stopped accepting and its calls are gone, lingering topics go at their next tick
+    std::atomic<bool> stopping{false};
+
+    // handlers, coroutines and topics not released yet, may be read from any thread
+    std::size_t live_handlers() const;
+};
+
+using server_shard_ptr = std::shared_ptr<server_shard>;
+
+// Stats reply of both engines
+void fill_stats_reply(server_engine engine, proto::StatsReply& reply);
+
 class server : public QObject
 {
     Q_OBJECT
 
 public:
-    explicit server(uint16_t port);
+    explicit server(uint16_t port, server_options options = {});
     ~server() override;
 
     void init();
+    // init() succeeded and stop() was not called yet
+    bool serving() const { return _server && !_stopped; }
+
+    // channel to this server without a socket, valid after init() with any transport
+    std::shared_ptr<::grpc::Channel> in_process_channel(const ::grpc::ChannelArguments& args = {});
 
 private slots:
     void stop();
     void poll();
+    void dispatch();
+    void dump_metrics();
 
 private:
+    void init_queue_engine(const std::string& server_address);
+    void init_callback_engine(const std::string& server_address);
+    void run(std::size_t index);
+    // stops accepting, lets the calls in flight finish until drain_timeout and waits for every handler to go away
+    void drain();
+    // serves the queue of POLLING and EVENT modes for about a millisecond while stop() blocks the Qt thread
+    void drive();
+
     const uint16_t _port;
+    const server_options _options;
     QTimer _timer;
+    QTimer _metrics_timer;
+    metrics_snapshot _last_metrics;
 
     grpc_server_ptr _server;
-    grpc_server_queue_ptr _queue;
+    std::vector<server_shard_ptr> _shards;
+    std::vector<std::thread> _threads;
+    std::unique_ptr<queue_dispatcher> _dispatcher;
+    std::vector<queue_dispatcher::event> _events;
     async_service_ptr _service;
+    std::unique_ptr<callback_service> _callback_service;
+    std::shared_ptr<admission_control> _admission;
+    bool _stopped = false;
 };
 
 // ---------------------------------------------------------------------------------------------------------------------
 
-class server_method_handler_stub
-{
-public:
-    virtual bool proceed(bool ok) = 0;
-    virtual ~server_method_handler_stub() = default;
-};
-
 template <typename Writer, typename Service, typename Request, typename Reply>
 class server_method_handler : public server_method_handler_stub
 {
@@ -68,19 +333,29 @@ protected:
     using request_type = Request;
     using reply_type = Reply;
 
+    server_shard_ptr _shard;
     grpc_server_queue_ptr _queue;
     grpc_server_context _context;
 
     writer_type _responder;
     service_type _service;
-    request_type _request;
-    reply_type _reply;
+    handler_arena _arena;
+    arena_message<request_type> _request;
+    arena_message<reply_type> _reply;
+    call_metrics _metrics;
+    call_compression _compression;
 
-    server_method_handler(Service service, grpc_server_queue_ptr queue) :
-        _queue(queue),
+    server_method_handler(server_shard_ptr shard, metric_method method, const char* const* state_names) :
+        _shard(shard),
+        _queue(shard->queue),
         _context(),
         _responder(&_context),
-        _service(service)
+        _service(shard->service),
+        _arena(shard->options.arena),
+        _request(_arena.get()),
+        _reply(_arena.get()),
+        _metrics(metric_side::SERVER, method, state_names),
+        _compression(shard->options.compression, method, shard->compression)
     {}
     virtual ~server_method_handler() = default;
 };
@@ -90,8 +365,8 @@ class server_method_handler_oto :
     public server_method_handler<server_async_response_writer<Reply>, Service, Request, Reply>
 {
 public:
-    server_method_handler_oto(Service service, grpc_server_queue_ptr queue) :
-        server_method_handler<server_async_response_writer<Reply>, Service, Request, Reply>(service, queue)
+    server_method_handler_oto(server_shard_ptr shard, metric_method method) :
+        server_method_handler<server_async_response_writer<Reply>, Service, Request, Reply>(shard, method, state_names)
     {}
 
     server_method_handler_oto(const server_method_handler_oto&) = delete;
@@ -106,115 +381,961 @@ protected:
         PROCESS,
         FINISH
     };
+    static constexpr const char* state_names[] = {"CREATE", "PROCESS", "FINISH", nullptr};
 
     handler_state _state = handler_state::CREATE;
 };
 
-template <typename Service, typename Request, typename Reply>
-class server_method_handler_otm : public server_method_handler<server_async_writer<Reply>, Service, Request, Reply>
+// ---------------------------------------------------------------------------------------------------------------------
+// Completion tag of one direction of a many-to-many call. Reads and writes of the call are in flight at the same
+// time, so each of them completes on its own tag and is forwarded to the handler.
+template <typename Handler>
+class server_method_handler_tag : public server_method_handler_stub
 {
 public:
-    server_method_handler_otm(Service service, grpc_server_queue_ptr queue) :
-        server_method_handler<server_async_writer<Reply>, Service, Request, Reply>(service, queue)
-    {}
+    using callback_type = void (Handler::*)(bool ok);
 
-    server_method_handler_otm(const server_method_handler_otm&) = delete;
-    server_method_handler_otm& operator=(const server_method_handler_otm&) = delete;
-    server_method_handler_otm(server_method_handler_otm&&) = delete;
-    server_method_handler_otm& operator=(server_method_handler_otm&&) = delete;
+    server_method_handler_tag(Handler* handler, callback_type callback) : _handler(handler), _callback(callback) {}
+
+    bool proceed(bool ok) override
+    {
+        (_handler->*_callback)(ok);
+        return true;
+    }
+
+protected:
+    // the tag is a part of its handler
+    void release() override {}
+
+private:
+    Handler* _handler;
+    callback_type _callback;
+};
+
+// AsyncNotifyWhenDone of one call. Registered before the call is requested, it completes as soon as the client cancels
+// the call or its deadline expires, after the last operation otherwise, and never for a call that was not matched. The
+// tag reads the context of the call, so a matched handler is released once both its last operation and this tag are
+// done.
+template <typename Handler>
+class call_done_tag : public server_method_handler_stub
+{
+public:
+    using callback_type = void (Handler::*)();
+
+    call_done_tag(Handler* handler, callback_type callback) : _handler(handler), _callback(callback) {}
+
+    // before the call is requested
+    void watch(grpc_server_context& context)
+    {
+        _context = &context;
+        _pending = true;
+        context.AsyncNotifyWhenDone(this);
+    }
+
+    bool pending() const { return _pending; }
+    // valid once the tag is done
+    bool cancelled() const { return _cancelled; }
+
+    bool proceed(bool) override
+    {
+        _pending = false;
+        _cancelled = _context->IsCancelled();
+        (_handler->*_callback)();
+        return true;
+    }
+
+protected:
+    // the tag is a part of its handler
+    void release() override {}
+
+private:
+    Handler* _handler;
+    callback_type _callback;
+    grpc_server_context* _context = nullptr;
+    bool _pending = false;
+    bool _cancelled = false;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// one-to-one Handler
+
+// Health probe: the request is never decoded and the reply comes encoded from the reply cache of the shard.
+class ping_server_handler : public server_method_handler_stub
+{
+public:
+    explicit ping_server_handler(server_shard_ptr shard);
+
+    bool proceed(bool ok) override;
+
+private:
+    void release() override;
+
+    enum class handler_state
+    {
+        CREATE,
+        PROCESS,
+        FINISH
+    };
+    static constexpr const char* state_names[] = {"CREATE", "PROCESS", "FINISH", nullptr};
+
+    handler_state _state = handler_state::CREATE;
+
+    server_shard_ptr _shard;
+    grpc_server_queue_ptr _queue;
+    grpc_server_context _context;
+    server_async_response_writer<::grpc::ByteBuffer> _responder;
+    async_service_ptr _service;
+    call_metrics _metrics;
+
+    ::grpc::ByteBuffer _request;
+    bool _rejected = false;
+};
+
+class stats_server_handler : public server_method_handler_oto<async_service_ptr, proto::EmptyRequest, proto::StatsReply>
+{
+public:
+    explicit stats_server_handler(server_shard_ptr shard);
 
     bool proceed(bool ok) override;
 
+private:
+    void release() override;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// one-to-many handler
+
+// Subscriber of the topic named by its request, writes the shared updates as they are.
+class stream_string_server_handler : public server_method_handler_stub
+{
+public:
+    explicit stream_string_server_handler(server_shard_ptr shard);
+    ~stream_string_server_handler() override;
+
+    bool proceed(bool ok) override;
+
+    // queues one shared update, 'last' ends the stream after it is written
+    void publish(const ::grpc::ByteBuffer& update, bool last);
+
+    // position in the subscriber list of its topic
+    std::size_t topic_index = 0;
+
+private:
+    void release() override;
+    void write();
+    // a cancelled subscriber leaves its topic at once instead of at its next write
+    void call_done();
+    // the last operation is done, the handler goes once the done tag is
+    void release_after_done();
+
+    enum class handler_state
+    {
+        CALL,
+        WAIT,
+        STREAM,
+        FINISH
+    };
+    static constexpr const char* state_names[] = {"CALL", "WAIT", "STREAM", "FINISH", nullptr};
+
+    handler_state _state = handler_state::CALL;
+
+    server_shard_ptr _shard;
+    grpc_server_queue_ptr _queue;
+    grpc_server_context _context;
+    server_async_writer<::grpc::ByteBuffer> _responder;
+    async_service_ptr _service;
+    call_metrics _metrics;
+    call_compression _compression;
+
+    ::grpc::ByteBuffer _request;
+    std::string _name;
+    topic* _topic = nullptr;
+
+    send_queue<::grpc::ByteBuffer> _send_queue;
+    bool _writing = false;
+    bool _last = false;
+
+    call_done_tag<stream_string_server_handler> _done;
+    bool _idle = false;
+
+    admission_ticket _ticket;
+};
+
+#ifdef FRANKENSTEIN_COROUTINES
+// tag type of server coroutines, the tags live in the frame so there is nothing to release
+class server_coroutine_stub : public server_method_handler_stub
+{
 protected:
-    virtual void handle_call_state() = 0;
-    virtual void handle_wait_state() = 0;
-    virtual void handle_write_state() = 0;
+    void release() override {}
+};
+
+// AsyncNotifyWhenDone of a coroutine call: the alarm a cancelled call is pacing on is cancelled, so the coroutine
+// resumes at once. The tag lives in the frame, the coroutine co_awaits it before returning.
+class server_coroutine_done final : public server_coroutine_stub
+{
+public:
+    // before the call is requested
+    void watch(grpc_server_context& context)
+    {
+        _context = &context;
+        _pending = true;
+        context.AsyncNotifyWhenDone(this);
+    }
+
+    // valid once the tag is done
+    bool cancelled() const { return _cancelled; }
+
+    bool proceed(bool) override
+    {
+        _pending = false;
+        _cancelled = _context->IsCancelled();
+        if (_waiting) {
+            // the coroutine returns and frees the frame holding this tag
+            _waiting.resume();
+            return true;
+        }
+        if (_cancelled && pacing)
+            pacing->Cancel();
+        return true;
+    }
+
+    // done right away for a call that was not matched
+    bool await_ready() const noexcept { return !_pending; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept { _waiting = handle; }
+    void await_resume() const noexcept {}
+
+    // set while the coroutine waits for it
+    ::grpc::Alarm* pacing = nullptr;
+
+private:
+    grpc_server_context* _context = nullptr;
+    std::coroutine_handle<> _waiting;
+    bool _pending = false;
+    bool _cancelled = false;
+};
+
+// StreamInt as one coroutine, replaces stream_int_server_handler: same messages at the same pace. The frame comes
+// from the frame allocator of the shard and is given back when the call is finished.
+coroutine_task stream_int_coroutine(frame_allocator& frames, server_shard_ptr shard);
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+// payload producers of stream_server_handler
+
+// One value per message counting down from stream_length, written at stream_interval. The stream ends with the last
+// value written once more. The seq of a value is its position in the countdown, so a resumed call regenerates what
+// it missed and needs no replay history.
+template <typename Traits>
+class countdown_producer
+{
+public:
+    explicit countdown_producer(const server_options& options) :
+        _interval(options.stream_interval),
+        _amount(options.stream_length)
+    {}
+
+    std::chrono::microseconds write_interval() const { return _interval; }
+    // skips the values up to seq 'after', before the first next()
+    void resume(uint64_t after)
+    {
+        const auto skipped = static_cast<std::size_t>(std::min<uint64_t>(after, _amount));
+        _amount -= skipped;
+        _seq = skipped;
+    }
+    // fills 'reply' with the next message, false when 'reply' is the last one and ends the stream
+    bool next(typename Traits::reply_type& reply)
+    {
+        if (_amount == 0)
+            return false;
+
+        Traits::set(reply, _amount--, ++_seq);
+        reply.set_sent_at_ns(wall_clock_ns());
+        LOG_TRACE("%s::next(): write one value", Traits::name);
+        return true;
+    }
+    // the next message is due right away
+    bool backlog() const { return false; }
+
+private:
+    const std::chrono::microseconds _interval;
+    std::size_t _amount;
+    uint64_t _seq = 0;
+};
+
+// Produces stream values at stream_interval and hands them out in batches of at most stream_batch_size.
+class batch_coalescer
+{
+public:
+    explicit batch_coalescer(const server_options& options);
+
+    // how often a batched stream writes (size or time threshold, whichever comes first), zero is back-to-back
+    std::chrono::microseconds write_interval() const;
+    // number of values produced up to 'now' and not taken yet, at most one batch
+    std::size_t take(std::chrono::system_clock::time_point now);
+    // more values than one batch were pending at the last take()
+    bool backlog() const { return _backlog; }
+
+private:
+    const std::chrono::microseconds _interval;
+    const std::size_t _batch_size;
+    const std::chrono::microseconds _batch_delay;
+
+    std::chrono::system_clock::time_point _next_value;
+    bool _backlog = false;
+};
+
+// The countdown handed out in batches by batch_coalescer, the batch with the last value ends the stream.
+template <typename Traits>
+class batch_producer
+{
+public:
+    explicit batch_producer(const server_options& options) : _coalescer(options), _amount(options.stream_length) {}
+
+    std::chrono::microseconds write_interval() const { return _coalescer.write_interval(); }
+    // batches carry no sequence numbers, a broken batched stream starts anew
+    void resume(uint64_t) {}
+    bool next(typename Traits::reply_type& reply)
+    {
+        const auto count = std::min(_amount, _coalescer.take(std::chrono::system_clock::now()));
+
+        reply.Clear();
+        reply.mutable_msg()->Reserve(static_cast<int>(count));
+        for (std::size_t i = 0; i < count; ++i)
+            Traits::add(reply, _amount--);
+        reply.set_sent_at_ns(wall_clock_ns());
+
+        LOG_TRACE("%s::next(): write %zu values", Traits::name, count);
+        return _amount > 0;
+    }
+    bool backlog() const { return _coalescer.backlog(); }
+
+private:
+    batch_coalescer _coalescer;
+    std::size_t _amount;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// one-to-many handler
+
+// Paced server stream of one method, everything the methods differ in comes from 'Traits':
+//   reply_type       reply message
+//   producer_type    fills the replies (countdown_producer, batch_producer)
+//   method           metric_method of the call
+//   request          async_service member requesting the call
+//   handlers(shard)  object pool of the handler
+//   name             handler name for logging
+// The states are dispatched in proceed() without any virtual call, proceed() and release() are the whole vtable.
+template <typename Traits>
+class stream_server_handler final :
+    public server_method_handler<server_async_writer<typename Traits::reply_type>,
+                                 async_service_ptr,
+                                 proto::NameRequest,
+                                 typename Traits::reply_type>
+{
+public:
+    explicit stream_server_handler(server_shard_ptr shard);
+    ~stream_server_handler() override { LOG_TRACE("%s::dtor()", Traits::name); }
+
+    stream_server_handler(const stream_server_handler&) = delete;
+    stream_server_handler& operator=(const stream_server_handler&) = delete;
+    stream_server_handler(stream_server_handler&&) = delete;
+    stream_server_handler& operator=(stream_server_handler&&) = delete;
+
+    bool proceed(bool ok) override;
+
+private:
+    void release() override;
+    // writes the next message of the producer, or the last one with the end of the stream
+    void write();
+    // a cancelled stream stops pacing at once instead of failing at its next write
+    void call_done();
+    // the last operation is done, the handler goes once the done tag is
+    void release_after_done();
 
     enum class handler_state
     {
         CALL,
         WAIT,
         WRITE,
+        PACE,
         FINISH
     };
+    static constexpr const char* state_names[] = {"CALL", "WAIT", "WRITE", "PACE", "FINISH", nullptr};
 
     handler_state _state = handler_state::CALL;
+    typename Traits::producer_type _producer;
+
+    // pacing: the next message is written when the alarm fires on the handler queue instead of blocking the poller
+    ::grpc::Alarm _alarm;
+    const std::chrono::microseconds _interval;
+    std::chrono::system_clock::time_point _next_write;
+    // skips pacing once, the producer still has data to send right after a write
+    bool _write_now = false;
+    // holds messages back on top of the pacing
+    token_bucket _rate;
+
+    call_done_tag<stream_server_handler> _done;
+    bool _idle = false;
+
+    admission_ticket _ticket;
+    bool _rejected = false;
+};
+
+struct stream_int_server_traits
+{
+    using reply_type = proto::IntReply;
+    using producer_type = countdown_producer<stream_int_server_traits>;
+    static constexpr metric_method method = metric_method::STREAM_INT;
+    static constexpr auto request = &async_service::RequestStreamInt;
+    static constexpr const char* name = "stream_int_server_handler";
+
+    static object_pool<stream_int_server_handler>& handlers(server_shard& shard) { return shard.stream_int_handlers; }
+    static void set(reply_type& reply, std::size_t value, uint64_t seq)
+    {
+        reply.set_msg(static_cast<int32_t>(value));
+        reply.set_seq(seq);
+    }
+};
+
+struct stream_string_batch_server_traits
+{
+    using reply_type = proto::StringBatchReply;
+    using producer_type = batch_producer<stream_string_batch_server_traits>;
+    static constexpr metric_method method = metric_method::STREAM_STRING_BATCH;
+    static constexpr auto request = &async_service::RequestStreamStringBatch;
+    static constexpr const char* name = "stream_string_batch_server_handler";
+
+    static object_pool<stream_string_batch_server_handler>& handlers(server_shard& shard)
+    {
+        return shard.stream_string_batch_handlers;
+    }
+    static void add(reply_type& reply, std::size_t value) { reply.add_msg(std::to_string(value)); }
+};
+
+struct stream_int_batch_server_traits
+{
+    using reply_type = proto::IntBatchReply;
+    using producer_type = batch_producer<stream_int_batch_server_traits>;
+    static constexpr metric_method method = metric_method::STREAM_INT_BATCH;
+    static constexpr auto request = &async_service::RequestStreamIntBatch;
+    static constexpr const char* name = "stream_int_batch_server_handler";
+
+    static object_pool<stream_int_batch_server_handler>& handlers(server_shard& shard)
+    {
+        return shard.stream_int_batch_handlers;
+    }
+    static void add(reply_type& reply, std::size_t value) { reply.add_msg(static_cast<int32_t>(value)); }
 };
 
-template <typename S, typename Req, typename Rep>
-bool server_method_handler_otm<S, Req, Rep>::proceed(bool ok)
+template <typename Traits>
+stream_server_handler<Traits>::stream_server_handler(server_shard_ptr shard) :
+    server_method_handler<server_async_writer<typename Traits::reply_type>,
+                          async_service_ptr,
+                          proto::NameRequest,
+                          typename Traits::reply_type>(shard, Traits::method, state_names),
+    _producer(shard->options),
+    _interval(_producer.write_interval()),
+    _rate(shard->options.admission.message_limit()),
+    _done(this, &stream_server_handler::call_done)
 {
-    LOG("server_method_handler_otm::proceed()");
+    LOG_TRACE("%s::ctor()", Traits::name);
+    proceed(true);
+}
+
+template <typename Traits>
+bool stream_server_handler<Traits>::proceed(bool ok)
+{
+    LOG_TRACE("%s::proceed()", Traits::name);
+
+    this->_metrics.state_done(_state);
 
     if (_state == handler_state::FINISH) {
-        LOG("server_method_handler_otm::proceed(): call finished");
+        LOG_TRACE("%s::proceed(): call finished", Traits::name);
+        if (ok && !_rejected)
+            this->_metrics.sent();
+        else
+            this->_metrics.fail();
+        release_after_done();
         return false;
     }
 
-    if (ok) {
-        if (_state == handler_state::CALL)
-            this->handle_call_state();
-        else if (_state == handler_state::WAIT)
-            this->handle_wait_state();
-        else if (_state == handler_state::WRITE)
-            this->handle_write_state();
-    } else {
-        if (_state == handler_state::WAIT) {
-            // server has been shut down before receiving a matching DownloadRequest
-            LOG("server_method_handler_otm::proceed(): server has been shut down before receiving a matching "
-                "request");
-            return false;
+    if (!ok && _state == handler_state::WAIT) {
+        // no call, no done tag either
+        LOG_DEBUG("%s::proceed(): server has been shut down before receiving a matching request", Traits::name);
+        release();
+        return false;
+    }
+
+    if (!ok || (_state != handler_state::WAIT && _done.cancelled())) {
+        LOG_DEBUG("%s::proceed(): abort: call is cancelled or connection is dropped", Traits::name);
+        this->_metrics.fail();
+        release_after_done();
+        return false;
+    }
+
+    switch (_state) {
+    case handler_state::CALL:
+        _state = handler_state::WAIT;
+        _done.watch(this->_context);
+        ((*this->_service).*Traits::request)(&this->_context,
+                                             this->_request.get(),
+                                             &this->_responder,
+                                             this->_queue.get(),
+                                             this->_queue.get(),
+                                             this);
+        break;
+    case handler_state::WAIT: {
+        this->_metrics.start();
+        Traits::handlers(*this->_shard).create(this->_shard);
+
+        const auto admitted = this->_shard->admission->admit_stream(this->_request->name(), this->_context, _ticket);
+        if (!admitted.ok()) {
+            this->_metrics.fail();
+            _rejected = true;
+            _state = handler_state::FINISH;
+            this->_responder.Finish(admitted, this);
+            break;
+        }
+
+        this->_compression.start(this->_context);
+        _producer.resume(this->_request->resume_after());
+
+        // an empty message opens the stream
+        _state = handler_state::WRITE;
+        this->_responder.Write(*this->_reply, this->_compression.write_options(*this->_reply), this);
+        break;
+    }
+    case handler_state::WRITE: {
+        this->_metrics.sent();
+        const auto now = std::chrono::system_clock::now();
+        const bool paced = _interval.count() > 0 && !_write_now;
+        auto due = now;
+        if (paced) {
+            // fixed rate: a late alarm does not shift the following ones unless the stream fell behind entirely
+            if (_next_write.time_since_epoch().count() == 0)
+                _next_write = now;
+            _next_write = std::max(now, _next_write + _interval);
+            due = _next_write;
+        }
+
+        // a message over the rate limit waits for its token
+        due = _rate.reserve(due);
+        if (!paced && due == now) {
+            write();
         } else {
-            LOG("server_method_handler_otm::proceed(): abort: call is cancelled or connection is dropped");
-            return false;
+            _state = handler_state::PACE;
+            _alarm.Set(this->_queue.get(), due, this);
         }
+        break;
+    }
+    case handler_state::PACE:
+        _state = handler_state::WRITE;
+        write();
+        break;
+    case handler_state::FINISH:
+        break;
     }
 
     return true;
 }
 
-// ---------------------------------------------------------------------------------------------------------------------
-// one-to-one Handler
+template <typename Traits>
+void stream_server_handler<Traits>::write()
+{
+    if (!_producer.next(*this->_reply)) {
+        _state = handler_state::FINISH;
+        this->_responder.WriteAndFinish(
+            *this->_reply, this->_compression.write_options(*this->_reply), grpc_status::OK, this);
+        return;
+    }
+
+    // the next message follows right away, let grpc coalesce both into one frame
+    _write_now = _producer.backlog();
+    auto options = ::grpc::WriteOptions();
+    if (_write_now)
+        options.set_buffer_hint();
+    this->_responder.Write(*this->_reply, this->_compression.write_options(*this->_reply, options), this);
+}
 
-class ping_server_handler : public server_method_handler_oto<async_service_ptr, proto::EmptyRequest, proto::StringReply>
+template <typename Traits>
+void stream_server_handler<Traits>::call_done()
 {
-public:
-    ping_server_handler(async_service_ptr service, grpc_server_queue_ptr queue);
+    if (_idle) {
+        release();
+        return;
+    }
 
-    bool proceed(bool ok) override;
-};
+    // the alarm completes with ok=false, a pending write fails by itself
+    if (_done.cancelled() && _state == handler_state::PACE) {
+        LOG_DEBUG("%s::call_done(): cancelled, stop pacing", Traits::name);
+        _alarm.Cancel();
+    }
+}
+
+template <typename Traits>
+void stream_server_handler<Traits>::release_after_done()
+{
+    if (_done.pending()) {
+        _idle = true;
+        return;
+    }
+
+    release();
+}
+
+template <typename Traits>
+void stream_server_handler<Traits>::release()
+{
+    const auto shard = this->_shard;
+    Traits::handlers(*shard).destroy(this);
+}
 
 // ---------------------------------------------------------------------------------------------------------------------
-// one-to-many handler
+// many-to-many methods, every request restarts the stream for its name
 
-class stream_string_server_handler :
-    public server_method_handler_otm<async_service_ptr, proto::NameRequest, proto::StringReply>
+// Bidirectional stream of one method: every request of the client restarts the countdown for its name, the values are
+// produced on an alarm and written through a send queue. Everything the methods differ in comes from 'Traits':
+//   reply_type          reply message
+//   method              metric_method of the call
+//   request             async_service member requesting the call
+//   handlers(shard)     object pool of the handler
+//   set(reply, value)   fills the reply with one value of the countdown
+//   name                handler name for logging
+// The states are dispatched without any virtual call, proceed() and release() are the whole vtable.
+template <typename Traits>
+class bi_stream_server_handler final :
+    public server_method_handler<server_async_reader_writer<typename Traits::reply_type, proto::NameRequest>,
+                                 async_service_ptr,
+                                 proto::NameRequest,
+                                 typename Traits::reply_type>
 {
 public:
-    stream_string_server_handler(async_service_ptr service, grpc_server_queue_ptr queue);
-    ~stream_string_server_handler() override;
+    explicit bi_stream_server_handler(server_shard_ptr shard);
+    ~bi_stream_server_handler() override { LOG_TRACE("%s::dtor()", Traits::name); }
+
+    bi_stream_server_handler(const bi_stream_server_handler&) = delete;
+    bi_stream_server_handler& operator=(const bi_stream_server_handler&) = delete;
+    bi_stream_server_handler(bi_stream_server_handler&&) = delete;
+    bi_stream_server_handler& operator=(bi_stream_server_handler&&) = delete;
+
+    // call tag: request, arrival and Finish of the call, reads, writes and production complete on their own tags
+    bool proceed(bool ok) override;
 
 private:
-    void handle_call_state() override;
-    void handle_wait_state() override;
-    void handle_write_state() override;
+    using reply_type = typename Traits::reply_type;
+
+    void release() override;
+
+    enum class handler_state
+    {
+        CALL,
+        WAIT,
+        STREAM,
+        FINISH
+    };
+    static constexpr const char* state_names[] = {"CALL", "WAIT", "STREAM", "FINISH", nullptr};
+
+    handler_state _state = handler_state::CALL;
+    // conflation key of the values produced now
+    std::string _key;
+    // values left of the countdown of the current request
+    std::size_t _amount = 0;
+
+    // production waits for an alarm, otherwise it follows the writes
+    bool paced() const { return _interval.count() > 0 || _rate.limited(); }
+
+    void read();
+    void read_done(bool ok);
+    // takes one value from the producer and schedules the next one
+    void produce(bool ok);
+    void write();
+    void write_done(bool ok);
+    // the call is finished once the client half-closed and every produced value is written
+    void try_finish();
+    // a cancelled call stops producing at once instead of at its next write
+    void call_done();
+    // the last operation is done, the handler goes once the done tag is
+    void release_after_done();
+
+    server_method_handler_tag<bi_stream_server_handler> _read_tag;
+    server_method_handler_tag<bi_stream_server_handler> _write_tag;
+    server_method_handler_tag<bi_stream_server_handler> _produce_tag;
+    call_done_tag<bi_stream_server_handler> _done_tag;
+    bool _idle = false;
+
+    // values produced while a write is in flight wait here, a slow client only ever costs its own queue
+    send_queue<reply_type> _send_queue;
+
+    bool _reads_done = false;
+    bool _writing = false;
+    bool _writes_failed = false;
+    bool _producing = false;
+    // BLOCK policy: the queue was full, production waits for the next write completion
+    bool _blocked = false;
 
-    uint8_t amount = 5;
+    // production clock, values are produced at a fixed rate whether or not the client keeps up
+    ::grpc::Alarm _alarm;
+    bool _alarm_set = false;
+    std::chrono::microseconds _interval;
+    std::chrono::system_clock::time_point _next_value;
+    token_bucket _rate;
+
+    admission_ticket _ticket;
 };
 
-class stream_int_server_handler :
-    public server_method_handler_otm<async_service_ptr, proto::NameRequest, proto::IntReply>
+struct bi_stream_string_server_traits
 {
-public:
-    stream_int_server_handler(async_service_ptr service, grpc_server_queue_ptr queue);
-    ~stream_int_server_handler() override;
+    using reply_type = proto::StringReply;
+    static constexpr metric_method method = metric_method::BI_STREAM_STRING;
+    static constexpr auto request = &async_service::RequestBiStreamString;
+    static constexpr const char* name = "bi_stream_string_server_handler";
 
-private:
-    void handle_call_state() override;
-    void handle_wait_state() override;
-    void handle_write_state() override;
+    static object_pool<bi_stream_string_server_handler>& handlers(server_shard& shard)
+    {
+        return shard.bi_stream_string_handlers;
+    }
+    static void set(reply_type& reply, std::size_t value) { reply.set_msg(std::to_string(value)); }
+};
 
-    uint8_t amount = 5;
+struct bi_stream_int_server_traits
+{
+    using reply_type = proto::IntReply;
+    static constexpr metric_method method = metric_method::BI_STREAM_INT;
+    static constexpr auto request = &async_service::RequestBiStreamInt;
+    static constexpr const char* name = "bi_stream_int_server_handler";
+
+    static object_pool<bi_stream_int_server_handler>& handlers(server_shard& shard)
+    {
+        return shard.bi_stream_int_handlers;
+    }
+    static void set(reply_type& reply, std::size_t value) { reply.set_msg(static_cast<int32_t>(value)); }
 };
 
+template <typename Traits>
+bi_stream_server_handler<Traits>::bi_stream_server_handler(server_shard_ptr shard) :
+    server_method_handler<server_async_reader_writer<typename Traits::reply_type, proto::NameRequest>,
+                          async_service_ptr,
+                          proto::NameRequest,
+                          typename Traits::reply_type>(shard, Traits::method, state_names),
+    _read_tag(this, &bi_stream_server_handler::read_done),
+    _write_tag(this, &bi_stream_server_handler::write_done),
+    _produce_tag(this, &bi_stream_server_handler::produce),
+    _done_tag(this, &bi_stream_server_handler::call_done),
+    _send_queue(shard->options.send_queue, shard->send_queues),
+    _interval(shard->options.stream_interval),
+    _rate(shard->options.admission.message_limit())
+{
+    LOG_TRACE("%s::ctor()", Traits::name);
+    proceed(true);
+}
+
+template <typename Traits>
+bool bi_stream_server_handler<Traits>::proceed(bool ok)
+{
+    LOG_TRACE("%s::proceed()", Traits::name);
+
+    this->_metrics.state_done(_state);
+
+    if (_state == handler_state::FINISH) {
+        LOG_TRACE("%s::proceed(): call finished", Traits::name);
+        release_after_done();
+        return false;
+    }
+
+    if (!ok) {
+        LOG_DEBUG("%s::proceed(): server has been shut down before receiving a matching request", Traits::name);
+        this->release();
+        return false;
+    }
+
+    if (_state == handler_state::CALL) {
+        _done_tag.watch(this->_context);
+        _state = handler_state::WAIT;
+        ((*this->_service).*Traits::request)(
+            &this->_context, &this->_responder, this->_queue.get(), this->_queue.get(), this);
+    } else if (_state == handler_state::WAIT) {
+        this->_metrics.start();
+        Traits::handlers(*this->_shard).create(this->_shard);
+
+        // one call streams any number of names, only its peer is limited
+        const auto admitted = this->_shard->admission->admit_stream(std::string(), this->_context, _ticket);
+        if (!admitted.ok()) {
+            this->_metrics.fail();
+            _state = handler_state::FINISH;
+            this->_responder.Finish(admitted, this);
+            return true;
+        }
+
+        this->_compression.start(this->_context);
+        _state = handler_state::STREAM;
+        read();
+    }
+
+    return true;
+}
+
+template <typename Traits>
+void bi_stream_server_handler<Traits>::read()
+{
+    this->_responder.Read(this->_request.get(), &_read_tag);
+}
+
+template <typename Traits>
+void bi_stream_server_handler<Traits>::read_done(bool ok)
+{
+    LOG_TRACE("%s::read_done(ok=%d)", Traits::name, ok);
+
+    if (!ok) {
+        // client half-closed or the call is gone
+        _reads_done = true;
+        try_finish();
+        return;
+    }
+
+    this->_metrics.received();
+    LOG_DEBUG("%s::read_done(): subscribe '%s'", Traits::name, this->_request->name().c_str());
+    _key = this->_request->name();
+    _amount = this->_shard->options.stream_length;
+
+    // an idle producer starts right away, a running one picks the new request up with its next value
+    if (!_producing && !_writes_failed) {
+        _producing = true;
+        produce(true);
+    }
+
+    read();
+}
+
+template <typename Traits>
+void bi_stream_server_handler<Traits>::produce(bool)
+{
+    _alarm_set = false;
+
+    if (!_producing || _writes_failed) {
+        _producing = false;
+        try_finish();
+        return;
+    }
+
+    // a blocked producer still holds its last value in _reply
+    if (!_blocked) {
+        if (_amount == 0) {
+            _producing = false;
+            try_finish();
+            return;
+        }
+        Traits::set(*this->_reply, _amount--);
+    }
+
+    _blocked = !_send_queue.push(_key, std::move(*this->_reply));
+    if (_blocked) {
+        LOG_TRACE("%s::produce(): send queue is full, pause", Traits::name);
+        return;
+    }
+
+    if (!_writing)
+        write();
+
+    // back-to-back streams produce the next value when this one is written
+    if (!paced())
+        return;
+
+    const auto now = std::chrono::system_clock::now();
+    if (_next_value.time_since_epoch().count() == 0)
+        _next_value = now;
+    _next_value = _rate.reserve(std::max(now, _next_value + _interval));
+    _alarm_set = true;
+    _alarm.Set(this->_queue.get(), _next_value, &_produce_tag);
+}
+
+template <typename Traits>
+void bi_stream_server_handler<Traits>::write()
+{
+    // Write() serializes the value, its slot is free right after the call
+    _writing = true;
+    const auto& reply = _send_queue.front();
+    this->_responder.Write(reply, this->_compression.write_options(reply), &_write_tag);
+    _send_queue.pop();
+}
+
+template <typename Traits>
+void bi_stream_server_handler<Traits>::write_done(bool ok)
+{
+    LOG_TRACE("%s::write_done(ok=%d)", Traits::name, ok);
+
+    _writing = false;
+
+    if (!ok) {
+        LOG_DEBUG("%s::write_done(): call is cancelled or connection is dropped", Traits::name);
+        _writes_failed = true;
+        this->_metrics.fail();
+        // a pending alarm stops the producer itself
+        if (!_alarm_set)
+            _producing = false;
+        try_finish();
+        return;
+    }
+
+    this->_metrics.sent();
+    if (!_send_queue.empty() && !_writes_failed)
+        write();
+
+    if (_producing && !_alarm_set && (_blocked || !paced()))
+        produce(true);
+
+    try_finish();
+}
+
+template <typename Traits>
+void bi_stream_server_handler<Traits>::try_finish()
+{
+    if (!_reads_done || _producing || _writing || _alarm_set || _state != handler_state::STREAM)
+        return;
+
+    if (!_send_queue.empty() && !_writes_failed)
+        return;
+
+    LOG_TRACE("%s::try_finish(): finish", Traits::name);
+    this->_metrics.state_done(_state);
+    _state = handler_state::FINISH;
+    this->_responder.Finish(grpc_status::OK, this);
+}
+
+template <typename Traits>
+void bi_stream_server_handler<Traits>::call_done()
+{
+    if (_idle) {
+        this->release();
+        return;
+    }
+
+    if (!_done_tag.cancelled() || _writes_failed)
+        return;
+
+    // the pending read fails by itself, the production alarm would only fire at the next interval
+    LOG_DEBUG("%s::call_done(): cancelled, stop producing", Traits::name);
+    _writes_failed = true;
+    this->_metrics.fail();
+    if (_alarm_set)
+        _alarm.Cancel();
+}
+
+template <typename Traits>
+void bi_stream_server_handler<Traits>::release_after_done()
+{
+    if (_done_tag.pending()) {
+        _idle = true;
+        return;
+    }
+
+    this->release();
+}
+
+template <typename Traits>
+void bi_stream_server_handler<Traits>::release()
+{
+    const auto shard = this->_shard;
+    Traits::handlers(*shard).destroy(this);
+}
+
 } // namespace frankenstein
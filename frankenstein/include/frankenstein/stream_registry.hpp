@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace frankenstein {
+
+// Handlers of a client keyed by stream name. Every handler owns a slot until it is released, replaced handlers keep
+// their slot without a name. Names are found through an open-addressing table (linear probing, backward-shift
+// deletion) of 16-byte entries that holds only hashes and slot indexes; released slots are reused through a free
+// list. Not thread-safe.
+template <typename Handler>
+class stream_registry
+{
+public:
+    static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+
+    explicit stream_registry(std::size_t capacity = 64) { rehash(capacity); }
+
+    stream_registry(const stream_registry&) = delete;
+    stream_registry& operator=(const stream_registry&) = delete;
+
+    Handler* find(const std::string& name) const
+    {
+        const auto index = find_entry(name, std::hash<std::string>{}(name));
+        return index == npos ? nullptr : _slots[_table[index].slot].handler;
+    }
+
+    // registers 'handler' under 'name' and returns its slot, the handler registered before under the same name keeps
+    // its slot but loses the name and is returned in 'replaced'
+    std::size_t insert(const std::string& name, Handler* handler, Handler*& replaced)
+    {
+        const auto hash = std::hash<std::string>{}(name);
+        const auto slot = allocate(handler);
+
+        replaced = nullptr;
+        const auto index = find_entry(name, hash);
+        if (index != npos) {
+            auto& entry = _table[index];
+            replaced = _slots[entry.slot].handler;
+            _slots[entry.slot].named = false;
+            _slots[entry.slot].name.clear();
+            entry.slot = slot;
+        } else {
+            if ((_names + 1) * 2 > _table.size())
+                rehash(_table.size() * 2);
+            place(hash, slot);
+            ++_names;
+        }
+
+        _slots[slot].name = name;
+        _slots[slot].named = true;
+        return slot;
+    }
+
+    // frees the slot (and its name if it still has one), returns its handler
+    Handler* release(std::size_t slot)
+    {
+        auto& entry = _slots[slot];
+        if (entry.named) {
+            erase_entry(find_entry(entry.name, std::hash<std::string>{}(entry.name)));
+            --_names;
+        }
+
+        auto* handler = entry.handler;
+        entry.handler = nullptr;
+        entry.named = false;
+        entry.name.clear();
+        entry.next_free = _free;
+        _free = static_cast<uint32_t>(slot);
+        --_handlers;
+        return handler;
+    }
+
+    template <typename Function>
+    void for_each(Function&& function) const
+    {
+        for (const auto& slot : _slots) {
+            if (slot.handler)
+                function(slot.handler);
+        }
+    }
+
+    // registered names and all live handlers, replaced ones included
+    std::size_t names() const { return _names; }
+    std::size_t handlers() const { return _handlers; }
+
+private:
+    struct entry_type
+    {
+        std::size_t hash;
+        uint32_t slot = npos;
+    };
+
+    struct slot_type
+    {
+        Handler* handler = nullptr;
+        bool named = false;
+        uint32_t next_free = npos;
+        std::string name;
+    };
+
+    std::size_t mask() const { return _table.size() - 1; }
+
+    uint32_t find_entry(const std::string& name, std::size_t hash) const
+    {
+        for (auto index = hash & mask();; index = (index + 1) & mask()) {
+            const auto& entry = _table[index];
+            if (entry.slot == npos)
+                return npos;
+            if (entry.hash == hash && _slots[entry.slot].name == name)
+                return static_cast<uint32_t>(index);
+        }
+    }
+
+    void place(std::size_t hash, uint32_t slot)
+    {
+        auto index = hash & mask();
+        while (_table[index].slot != npos)
+            index = (index + 1) & mask();
+        _table[index] = {hash, slot};
+    }
+
+    // moves the following entries of the probe sequence back, so lookups never need tombstones
+    void erase_entry(uint32_t index)
+    {
+        auto hole = static_cast<std::size_t>(index);
+        for (auto next = (hole + 1) & mask(); _table[next].slot != npos; next = (next + 1) & mask()) {
+            const auto home = _table[next].hash & mask();
+            // the entry may move to the hole only if the hole lies between its home and its position
+            if (((next - home) & mask()) >= ((next - hole) & mask())) {
+                _table[hole] = _table[next];
+                hole = next;
+            }
+        }
+        _table[hole] = entry_type{};
+    }
+
+    void rehash(std::size_t capacity)
+    {
+        std::size_t size = 16;
+        while (size < capacity)
+            size *= 2;
+
+        std::vector<entry_type> table(size);
+        table.swap(_table);
+        for (const auto& entry : table) {
+            if (entry.slot != npos)
+                place(entry.hash, entry.slot);
+        }
+    }
+
+    uint32_t allocate(Handler* handler)
+    {
+        uint32_t slot = _free;
+        if (slot != npos) {
+            _free = _slots[slot].next_free;
+        } else {
+            slot = static_cast<uint32_t>(_slots.size());
+            _slots.emplace_back();
+        }
+
+        _slots[slot].handler = handler;
+        _slots[slot].next_free = npos;
+        ++_handlers;
+        return slot;
+    }
+
+    std::vector<entry_type> _table;
+    std::vector<slot_type> _slots;
+    uint32_t _free = npos;
+    std::size_t _names = 0;
+    std::size_t _handlers = 0;
+};
+
+} // namespace frankenstein
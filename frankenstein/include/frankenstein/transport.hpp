@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+
+namespace frankenstein {
+
+enum class transport_kind
+{
+    TCP,        // listens on / dials host:port
+    UNIX,       // unix domain socket, for clients on the same host
+    IN_PROCESS, // no socket at all, the client runs in the binary of the server and takes its channels from it
+};
+
+struct transport_options
+{
+    transport_kind kind = transport_kind::TCP;
+    // socket file of UNIX
+    std::string path;
+};
+
+const char* to_string(transport_kind kind);
+// "tcp", "unix:<path>" or "inprocess", returns false on anything else
+bool from_string(const std::string& name, transport_options& transport);
+
+// grpc address of the transport: 'tcp_address' over TCP, unix:<path> for UNIX, empty in-process where nothing
+// listens and nothing is dialed
+std::string transport_address(const transport_options& transport, const std::string& tcp_address);
+
+} // namespace frankenstein
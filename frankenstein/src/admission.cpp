@@ -0,0 +1,137 @@
+#include <frankenstein/admission.hpp>
+
+#include <utility>
+
+#include <frankenstein/logging.hpp>
+
+namespace frankenstein {
+
+void admission_ticket::reset()
+{
+    if (!_control)
+        return;
+
+    _control->leave(_name, _peer);
+    _control = nullptr;
+}
+
+admission_ticket::admission_ticket(admission_ticket&& other) noexcept :
+    _control(other._control),
+    _name(std::move(other._name)),
+    _peer(std::move(other._peer))
+{
+    other._control = nullptr;
+}
+
+admission_ticket& admission_ticket::operator=(admission_ticket&& other) noexcept
+{
+    if (this != &other) {
+        reset();
+        _control = other._control;
+        _name = std::move(other._name);
+        _peer = std::move(other._peer);
+        other._control = nullptr;
+    }
+    return *this;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+admission_control::admission_control(const admission_options& options) :
+    _options(options),
+    _enabled(options.streams_per_name || options.streams_per_peer || options.calls_per_second > 0)
+{}
+
+::grpc::Status admission_control::admit(const std::string& name, const std::string& peer, admission_ticket* ticket)
+{
+    const auto host = peer_host(peer);
+    const auto now = token_bucket::clock::now();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_peers.size() >= _sweep_at)
+        sweep(now);
+
+    const auto [entry, added] = _peers.try_emplace(host);
+    auto& client = entry->second;
+    if (added)
+        client.calls = token_bucket(_options.calls_per_second, _options.call_burst);
+
+    if (!client.calls.try_take(now)) {
+        ++_stats.rejected_rate;
+        LOG_DEBUG("admission_control::admit(peer=%s): over the call rate", host.c_str());
+        return ::grpc::Status(::grpc::StatusCode::RESOURCE_EXHAUSTED, "too many calls from this peer");
+    }
+
+    if (!ticket) {
+        ++_stats.admitted;
+        return ::grpc::Status::OK;
+    }
+
+    if (_options.streams_per_peer && client.streams >= _options.streams_per_peer) {
+        ++_stats.rejected_peer;
+        LOG_DEBUG("admission_control::admit(peer=%s): %zu streams open", host.c_str(), client.streams);
+        return ::grpc::Status(::grpc::StatusCode::RESOURCE_EXHAUSTED, "too many streams from this peer");
+    }
+
+    if (!name.empty() && _options.streams_per_name) {
+        auto& streams = _names[name];
+        if (streams >= _options.streams_per_name) {
+            ++_stats.rejected_name;
+            LOG_DEBUG("admission_control::admit(name=%s): %zu streams open", name.c_str(), streams);
+            return ::grpc::Status(::grpc::StatusCode::RESOURCE_EXHAUSTED, "too many streams of this name");
+        }
+        ++streams;
+    }
+
+    ++client.streams;
+    ++_stats.admitted;
+
+    ticket->_control = this;
+    ticket->_name = name;
+    ticket->_peer = host;
+    return ::grpc::Status::OK;
+}
+
+void admission_control::leave(const std::string& name, const std::string& peer)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!name.empty() && _options.streams_per_name) {
+        const auto found = _names.find(name);
+        if (found != _names.end() && --found->second == 0)
+            _names.erase(found);
+    }
+
+    const auto found = _peers.find(peer);
+    if (found != _peers.end() && found->second.streams)
+        --found->second.streams;
+}
+
+void admission_control::sweep(token_bucket::clock::time_point now)
+{
+    for (auto it = _peers.begin(); it != _peers.end();) {
+        if (it->second.streams == 0 && it->second.calls.full(now))
+            it = _peers.erase(it);
+        else
+            ++it;
+    }
+    _sweep_at = std::max<std::size_t>(1024, _peers.size() * 2);
+}
+
+admission_stats admission_control::stats() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+std::string admission_control::peer_host(const std::string& peer)
+{
+    if (peer.compare(0, 5, "ipv4:") != 0 && peer.compare(0, 5, "ipv6:") != 0)
+        return peer;
+
+    const auto colon = peer.rfind(':');
+    return colon > 4 ? peer.substr(0, colon) : peer;
+}
+
+} // namespace frankenstein
@@ -0,0 +1,686 @@
+#include <frankenstein/bench.hpp>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/alarm.h>
+
+#include <proto/exchange_service.grpc.pb.h>
+
+#include <frankenstein/commons.hpp>
+
+namespace frankenstein {
+
+namespace chr = std::chrono;
+
+namespace {
+
+using bench_clock = chr::steady_clock;
+using bench_stub = proto::ExchangeService::Stub;
+
+double cpu_seconds()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// grpc deadlines are system_clock based
+chr::system_clock::time_point to_deadline(bench_clock::time_point time)
+{
+    return chr::system_clock::now() + chr::duration_cast<chr::system_clock::duration>(time - bench_clock::now());
+}
+
+class bench_worker;
+
+// one concurrency slot: a call that is restarted on its own queue until the worker stops
+class bench_call
+{
+public:
+    bench_call(bench_worker& worker, std::size_t slot);
+    virtual ~bench_call() = default;
+
+    virtual void proceed(bool ok) = 0;
+
+    // waits for the pacing deadline of this slot (if any) and starts the next call
+    void next();
+    void cancel();
+    bool idle() const { return _idle; }
+
+protected:
+    virtual void start() = 0;
+
+    void pace_done(bool ok);
+
+    bench_worker& _worker;
+    std::optional<::grpc::ClientContext> _context;
+    ::grpc::Status _status;
+
+    bool _idle = true;
+    bool _pacing = false;
+
+private:
+    ::grpc::Alarm _alarm;
+    bench_clock::time_point _next_start;
+};
+
+class bench_worker
+{
+public:
+    bench_worker(const bench_options& options,
+                 std::shared_ptr<::grpc::Channel> channel,
+                 std::size_t first_slot,
+                 std::size_t slot_count,
+                 bench_clock::time_point begin,
+                 bench_clock::time_point end);
+
+    void run();
+
+    bench_stub& stub() { return *_stub; }
+    ::grpc::CompletionQueue* queue() { return &_queue; }
+    const bench_options& options() const { return _options; }
+    bench_clock::time_point begin() const { return _begin; }
+    bool stopping() const { return _stopping; }
+
+    void call_done(const ::grpc::Status& status)
+    {
+        ++_result.calls;
+        if (!status.ok() && !(_stopping && status.error_code() == ::grpc::StatusCode::CANCELLED))
+            ++_result.errors;
+    }
+    void round_trip(bench_clock::duration latency)
+    {
+        ++_result.messages;
+        _result.latency.record(nanoseconds(latency));
+    }
+    // a stream message carrying 'values', 'first' when it is the first one of its call, sent by the server at
+    // 'sent_at_ns' on its wall clock
+    void message(bench_clock::duration since, bool first, std::size_t values, uint64_t sent_at_ns)
+    {
+        _result.messages += values;
+        (first ? _result.first_message : _result.message_gap).record(nanoseconds(since));
+
+        // a server clock ahead of ours would give a negative delay, it counts as zero
+        const auto now = wall_clock_ns();
+        if (sent_at_ns)
+            _result.latency.record(now > sent_at_ns ? now - sent_at_ns : 0);
+    }
+
+    const bench_result& result() const { return _result; }
+
+private:
+    static uint64_t nanoseconds(bench_clock::duration duration)
+    {
+        return static_cast<uint64_t>(chr::duration_cast<chr::nanoseconds>(duration).count());
+    }
+
+    const bench_options& _options;
+    std::unique_ptr<bench_stub> _stub;
+    ::grpc::CompletionQueue _queue;
+
+    const bench_clock::time_point _begin;
+    const bench_clock::time_point _end;
+    bool _stopping = false;
+
+    std::vector<std::unique_ptr<bench_call>> _calls;
+    bench_result _result;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+bench_call::bench_call(bench_worker& worker, std::size_t slot) : _worker(worker)
+{
+    // slots start one after another at the configured rate
+    const auto rate = worker.options().rate;
+    if (rate > 0)
+        _next_start = worker.begin() + chr::duration_cast<bench_clock::duration>(chr::duration<double>(slot / rate));
+}
+
+void bench_call::next()
+{
+    _idle = false;
+
+    if (_worker.stopping()) {
+        _idle = true;
+        return;
+    }
+
+    const auto& options = _worker.options();
+    if (options.rate <= 0) {
+        start();
+        return;
+    }
+
+    // NOTE: a slot that fell behind starts right away, so latency of an overloaded server is underestimated
+    const auto now = bench_clock::now();
+    if (_next_start < now)
+        _next_start = now;
+
+    _pacing = true;
+    _alarm.Set(_worker.queue(), to_deadline(_next_start), this);
+
+    _next_start += chr::duration_cast<bench_clock::duration>(chr::duration<double>(options.concurrency / options.rate));
+}
+
+void bench_call::pace_done(bool ok)
+{
+    _pacing = false;
+    if (ok && !_worker.stopping())
+        start();
+    else
+        _idle = true;
+}
+
+void bench_call::cancel()
+{
+    if (_pacing)
+        _alarm.Cancel();
+    else if (!_idle && _context)
+        _context->TryCancel();
+}
+
+// values carried by one reply, none by the empty message that opens a stream
+template <typename Reply>
+std::size_t reply_values(const Reply& reply)
+{
+    return reply.ByteSizeLong() ? 1 : 0;
+}
+
+std::size_t reply_values(const proto::StringBatchReply& reply)
+{
+    return static_cast<std::size_t>(reply.msg_size());
+}
+
+std::size_t reply_values(const proto::IntBatchReply& reply)
+{
+    return static_cast<std::size_t>(reply.msg_size());
+}
+
+// seq of one reply, batches carry none
+template <typename Reply>
+uint64_t reply_seq(const Reply& reply)
+{
+    return reply.seq();
+}
+
+uint64_t reply_seq(const proto::StringBatchReply&)
+{
+    return 0;
+}
+
+uint64_t reply_seq(const proto::IntBatchReply&)
+{
+    return 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+class ping_call : public bench_call
+{
+public:
+    using bench_call::bench_call;
+
+    void proceed(bool ok) override
+    {
+        if (_pacing) {
+            pace_done(ok);
+            return;
+        }
+
+        if (ok && _status.ok())
+            _worker.round_trip(bench_clock::now() - _started);
+        _worker.call_done(_status);
+        next();
+    }
+
+private:
+    void start() override
+    {
+        _reader.reset();
+        _context.emplace();
+        _reply.Clear();
+        _started = bench_clock::now();
+
+        _reader = _worker.stub().AsyncPing(&*_context, _request, _worker.queue());
+        _reader->Finish(&_reply, &_status, this);
+    }
+
+    proto::EmptyRequest _request;
+    proto::StringReply _reply;
+    std::unique_ptr<::grpc::ClientAsyncResponseReader<proto::StringReply>> _reader;
+
+    bench_clock::time_point _started;
+};
+
+template <typename Reply>
+class stream_call : public bench_call
+{
+public:
+    using prepare_type = std::unique_ptr<::grpc::ClientAsyncReader<Reply>> (bench_stub::*)(
+        ::grpc::ClientContext*, const proto::NameRequest&, ::grpc::CompletionQueue*);
+
+    stream_call(bench_worker& worker, std::size_t slot, prepare_type prepare) :
+        bench_call(worker, slot),
+        _prepare(prepare)
+    {
+        _request.set_name("bench-" + std::to_string(slot));
+    }
+
+    void proceed(bool ok) override
+    {
+        if (_pacing) {
+            pace_done(ok);
+            return;
+        }
+
+        switch (_state) {
+            case stream_state::START:
+                if (!ok) {
+                    finish();
+                    break;
+                }
+                _state = stream_state::READ;
+                _reader->Read(&_reply, this);
+                break;
+            case stream_state::READ: {
+                if (!ok) {
+                    finish();
+                    break;
+                }
+                // the empty message that opens the stream carries no value, it only tells the call is accepted. The
+                // last value is written once more with the end of the stream and comes with the seq it had before.
+                const auto seq = reply_seq(_reply);
+                if (reply_values(_reply) && (!seq || seq != _last_seq)) {
+                    const auto now = bench_clock::now();
+                    _worker.message(now - _last, !_received, reply_values(_reply), _reply.sent_at_ns());
+                    _last = now;
+                    _last_seq = seq;
+                    _received = true;
+                }
+                _reply.Clear();
+                _reader->Read(&_reply, this);
+                break;
+            }
+            case stream_state::FINISH:
+                _worker.call_done(_status);
+                next();
+                break;
+        }
+    }
+
+private:
+    enum class stream_state
+    {
+        START,
+        READ,
+        FINISH
+    };
+
+    void start() override
+    {
+        _reader.reset();
+        _context.emplace();
+        _reply.Clear();
+
+        _reader = (_worker.stub().*_prepare)(&*_context, _request, _worker.queue());
+        _state = stream_state::START;
+        _last = bench_clock::now();
+        _last_seq = 0;
+        _received = false;
+        _reader->StartCall(this);
+    }
+
+    void finish()
+    {
+        _state = stream_state::FINISH;
+        _reader->Finish(&_status, this);
+    }
+
+    const prepare_type _prepare;
+    proto::NameRequest _request;
+    Reply _reply;
+    std::unique_ptr<::grpc::ClientAsyncReader<Reply>> _reader;
+
+    stream_state _state = stream_state::START;
+    // call start until the first value, then the previous message with values
+    bench_clock::time_point _last;
+    uint64_t _last_seq = 0;
+    bool _received = false;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+bench_worker::bench_worker(const bench_options& options,
+                           std::shared_ptr<::grpc::Channel> channel,
+                           std::size_t first_slot,
+                           std::size_t slot_count,
+                           bench_clock::time_point begin,
+                           bench_clock::time_point end) :
+    _options(options),
+    _stub(proto::ExchangeService::NewStub(channel)),
+    _begin(begin),
+    _end(end)
+{
+    for (std::size_t slot = first_slot; slot < first_slot + slot_count; ++slot) {
+        switch (options.method) {
+            case bench_method::PING:
+                _calls.push_back(std::make_unique<ping_call>(*this, slot));
+                break;
+            case bench_method::STREAM_STRING:
+                _calls.push_back(std::make_unique<stream_call<proto::StringReply>>(
+                    *this, slot, &bench_stub::PrepareAsyncStreamString));
+                break;
+            case bench_method::STREAM_INT:
+                _calls.push_back(
+                    std::make_unique<stream_call<proto::IntReply>>(*this, slot, &bench_stub::PrepareAsyncStreamInt));
+                break;
+            case bench_method::STREAM_STRING_BATCH:
+                _calls.push_back(std::make_unique<stream_call<proto::StringBatchReply>>(
+                    *this, slot, &bench_stub::PrepareAsyncStreamStringBatch));
+                break;
+            case bench_method::STREAM_INT_BATCH:
+                _calls.push_back(std::make_unique<stream_call<proto::IntBatchReply>>(
+                    *this, slot, &bench_stub::PrepareAsyncStreamIntBatch));
+                break;
+        }
+    }
+}
+
+void bench_worker::run()
+{
+    for (auto& call : _calls)
+        call->next();
+
+    void* tag;
+    bool ok = false;
+
+    while (!_stopping) {
+        const auto status = _queue.AsyncNext(&tag, &ok, to_deadline(_end));
+        if (status == ::grpc::CompletionQueue::GOT_EVENT) {
+            static_cast<bench_call*>(tag)->proceed(ok);
+        } else {
+            _stopping = true;
+        }
+    }
+
+    for (auto& call : _calls)
+        call->cancel();
+
+    auto busy = [this]() {
+        return std::any_of(_calls.begin(), _calls.end(), [](const auto& call) { return !call->idle(); });
+    };
+    while (busy() && _queue.Next(&tag, &ok))
+        static_cast<bench_call*>(tag)->proceed(ok);
+
+    _queue.Shutdown();
+    while (_queue.Next(&tag, &ok)) {}
+}
+
+std::string format_usec(uint64_t nsec)
+{
+    std::ostringstream out;
+    out.precision(1);
+    out << std::fixed << nsec / 1000.0;
+    return out.str();
+}
+
+std::string format_percentiles(const latency_histogram& histogram)
+{
+    return "p50 " + format_usec(histogram.percentile(50)) + ", p90 " + format_usec(histogram.percentile(90)) +
+           ", p99 " + format_usec(histogram.percentile(99)) + ", p999 " + format_usec(histogram.percentile(99.9)) +
+           ", max " + format_usec(histogram.max());
+}
+
+// JSON string literal of 'text', quotes included
+std::string json_string(const std::string& text)
+{
+    std::string out = "\"";
+    for (const char c : text) {
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                    out += escaped;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+    return out;
+}
+
+// JSON object of the percentiles of 'histogram' in nanoseconds
+std::string json_percentiles(const latency_histogram& histogram)
+{
+    std::ostringstream out;
+    out.precision(3);
+    out << std::fixed;
+    out << "{";
+    out << "\"p50\":" << histogram.percentile(50) << ",";
+    out << "\"p90\":" << histogram.percentile(90) << ",";
+    out << "\"p99\":" << histogram.percentile(99) << ",";
+    out << "\"p999\":" << histogram.percentile(99.9) << ",";
+    out << "\"min\":" << histogram.min() << ",";
+    out << "\"max\":" << histogram.max() << ",";
+    out << "\"mean\":" << histogram.mean() << "}";
+    return out.str();
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+const char* to_string(bench_method method)
+{
+    switch (method) {
+        case bench_method::PING:
+            return "ping";
+        case bench_method::STREAM_STRING:
+            return "stream_string";
+        case bench_method::STREAM_INT:
+            return "stream_int";
+        case bench_method::STREAM_STRING_BATCH:
+            return "stream_string_batch";
+        case bench_method::STREAM_INT_BATCH:
+            return "stream_int_batch";
+    }
+    return "";
+}
+
+bool from_string(const std::string& name, bench_method& method)
+{
+    for (auto candidate : {bench_method::PING,
+                           bench_method::STREAM_STRING,
+                           bench_method::STREAM_INT,
+                           bench_method::STREAM_STRING_BATCH,
+                           bench_method::STREAM_INT_BATCH}) {
+        if (name == to_string(candidate)) {
+            method = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace {
+
+// a server without the field or the RPC reports as "unknown"
+std::string query_server_engine(const std::shared_ptr<::grpc::Channel>& channel)
+{
+    auto stub = proto::ExchangeService::NewStub(channel);
+    ::grpc::ClientContext context;
+    context.set_deadline(chr::system_clock::now() + chr::seconds(5));
+
+    proto::StatsReply reply;
+    const auto status = stub->Stats(&context, proto::EmptyRequest(), &reply);
+    if (!status.ok()) {
+        LOG_WARN("query_server_engine(): Stats failed: %s", status.error_message().c_str());
+        return "unknown";
+    }
+    return reply.engine().empty() ? "unknown" : reply.engine();
+}
+
+} // namespace
+
+bench_result run_bench(const bench_options& options)
+{
+    const auto target = transport_address(options.transport, options.target);
+    if (target.empty()) {
+        LOG_ERROR("run_bench(): in-process transport needs the channel of the server");
+        bench_result result;
+        result.options = options;
+        return result;
+    }
+
+    return run_bench(options, ::grpc::CreateChannel(target, ::grpc::InsecureChannelCredentials()));
+}
+
+bench_result run_bench(const bench_options& options, std::shared_ptr<::grpc::Channel> channel)
+{
+    LOG_INFO("run_bench(): %s against %s over %s, concurrency %zu, threads %zu, rate %.1f, duration %lld ms",
+             to_string(options.method),
+             options.target.c_str(),
+             to_string(options.transport.kind),
+             options.concurrency,
+             options.threads,
+             options.rate,
+             static_cast<long long>(options.duration.count()));
+
+    const auto engine = query_server_engine(channel);
+
+    const std::size_t threads = std::max<std::size_t>(1, std::min(options.threads, options.concurrency));
+    const auto begin = bench_clock::now();
+    const auto end = begin + options.duration;
+    const double cpu_begin = cpu_seconds();
+
+    std::vector<std::unique_ptr<bench_worker>> workers;
+    std::size_t first_slot = 0;
+    for (std::size_t i = 0; i < threads; ++i) {
+        const std::size_t slot_count = options.concurrency / threads + (i < options.concurrency % threads ? 1 : 0);
+        workers.push_back(std::make_unique<bench_worker>(options, channel, first_slot, slot_count, begin, end));
+        first_slot += slot_count;
+    }
+
+    std::vector<std::thread> pool;
+    for (auto& worker : workers)
+        pool.emplace_back(&bench_worker::run, worker.get());
+    for (auto& thread : pool)
+        thread.join();
+
+    bench_result result;
+    result.options = options;
+    result.server_engine = engine;
+    result.seconds = chr::duration<double>(bench_clock::now() - begin).count();
+    result.cpu_seconds = cpu_seconds() - cpu_begin;
+
+    for (const auto& worker : workers) {
+        const auto& part = worker->result();
+        result.calls += part.calls;
+        result.messages += part.messages;
+        result.errors += part.errors;
+        result.latency.merge(part.latency);
+        result.first_message.merge(part.first_message);
+        result.message_gap.merge(part.message_gap);
+    }
+
+    return result;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+namespace {
+
+// address dialed, or the transport when nothing is dialed
+std::string target_name(const bench_options& options)
+{
+    const auto address = transport_address(options.transport, options.target);
+    return address.empty() ? to_string(options.transport.kind) : address;
+}
+
+} // namespace
+
+std::string bench_result::to_text() const
+{
+    std::ostringstream out;
+    out.precision(1);
+    out << std::fixed;
+
+    const double ops = messages ? static_cast<double>(messages) : 1.0;
+
+    out << "method:      " << to_string(options.method) << " @ " << target_name(options) << " ("
+        << to_string(options.transport.kind) << ", " << server_engine << " engine)\n";
+    out << "concurrency: " << options.concurrency << " (" << options.threads << " threads)";
+    if (options.rate > 0)
+        out << ", rate " << options.rate << " calls/s";
+    out << "\n";
+    out << "duration:    " << seconds << " s\n";
+    out << "calls:       " << calls << " (" << errors << " errors)\n";
+    out << "messages:    " << messages << " (" << messages / seconds << " msg/s)\n";
+    out << "latency us:  " << format_percentiles(latency) << "\n";
+    if (options.method != bench_method::PING) {
+        out << "first us:    " << format_percentiles(first_message) << "\n";
+        out << "gap us:      " << format_percentiles(message_gap) << "\n";
+    }
+    out << "cpu:         " << cpu_seconds << " s, " << cpu_seconds * 1e6 / ops << " us/msg\n";
+
+    return out.str();
+}
+
+std::string bench_result::to_json() const
+{
+    std::ostringstream out;
+    out.precision(3);
+    out << std::fixed;
+
+    const double ops = messages ? static_cast<double>(messages) : 1.0;
+
+    out << "{";
+    out << "\"method\":" << json_string(to_string(options.method)) << ",";
+    out << "\"target\":" << json_string(target_name(options)) << ",";
+    out << "\"transport\":" << json_string(to_string(options.transport.kind)) << ",";
+    out << "\"engine\":" << json_string(server_engine) << ",";
+    out << "\"concurrency\":" << options.concurrency << ",";
+    out << "\"threads\":" << options.threads << ",";
+    out << "\"rate\":" << options.rate << ",";
+    out << "\"seconds\":" << seconds << ",";
+    out << "\"calls\":" << calls << ",";
+    out << "\"errors\":" << errors << ",";
+    out << "\"messages\":" << messages << ",";
+    out << "\"throughput\":" << messages / seconds << ",";
+    out << "\"latency_ns\":" << json_percentiles(latency) << ",";
+    if (options.method != bench_method::PING) {
+        out << "\"first_message_ns\":" << json_percentiles(first_message) << ",";
+        out << "\"message_gap_ns\":" << json_percentiles(message_gap) << ",";
+    }
+    out << "\"cpu_seconds\":" << cpu_seconds << ",";
+    out << "\"cpu_us_per_message\":" << cpu_seconds * 1e6 / ops;
+    out << "}";
+
+    return out.str();
+}
+
+} // namespace frankenstein
@@ -0,0 +1,779 @@
+#include <frankenstein/callback_service.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <grpcpp/alarm.h>
+#if __has_include(<grpcpp/version_info.h>)
+#include <grpcpp/version_info.h>
+#endif
+
+#include <frankenstein/logging.hpp>
+#include <frankenstein/metrics.hpp>
+
+namespace frankenstein {
+
+namespace chr = std::chrono;
+
+namespace {
+
+// the callback flavour of Alarm::Set is still experimental in the grpc we build against, newer ones dropped the
+// experimental() accessor
+template <typename Deadline>
+void set_alarm(::grpc::Alarm& alarm, const Deadline& deadline, std::function<void(bool)> callback)
+{
+#ifdef GRPC_CPP_VERSION_MAJOR
+    alarm.Set(deadline, std::move(callback));
+#else
+    alarm.experimental().Set(deadline, std::move(callback));
+#endif
+}
+
+// fixed rate: a late alarm does not shift the following ones unless the stream fell behind entirely
+chr::system_clock::time_point next_tick(chr::system_clock::time_point& next, chr::microseconds interval)
+{
+    const auto now = chr::system_clock::now();
+    if (next.time_since_epoch().count() == 0)
+        next = now;
+    next = std::max(now, next + interval);
+    return next;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// one-to-one reactor
+
+// Finished by the method itself, counts the reply as sent once the call is done without being cancelled.
+class callback_unary_reactor : public ::grpc::ServerUnaryReactor
+{
+public:
+    explicit callback_unary_reactor(metric_method method) : _metrics(metric_side::SERVER, method, nullptr)
+    {
+        _metrics.start();
+    }
+
+    void OnCancel() override
+    {
+        _cancelled = true;
+        _metrics.fail();
+    }
+
+    void OnDone() override
+    {
+        if (!_cancelled && !_rejected)
+            _metrics.sent();
+        delete this;
+    }
+
+    // ends the call with 'status' instead of a reply
+    void reject(const ::grpc::Status& status)
+    {
+        _metrics.fail();
+        _rejected = true;
+        Finish(status);
+    }
+
+private:
+    call_metrics _metrics;
+    bool _cancelled = false;
+    bool _rejected = false;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// one-to-many reactor
+
+// A stream refused before its reactor is built (malformed or not admitted), finished with 'status' and nothing else.
+template <typename Reply>
+class rejected_stream_reactor : public ::grpc::ServerWriteReactor<Reply>
+{
+public:
+    rejected_stream_reactor(metric_method method, const ::grpc::Status& status) :
+        _metrics(metric_side::SERVER, method, nullptr)
+    {
+        _metrics.start();
+        _metrics.fail();
+        this->Finish(status);
+    }
+
+    void OnDone() override { delete this; }
+
+private:
+    call_metrics _metrics;
+};
+
+// Writes the messages of produce() one at a time, paced at a fixed rate by a callback alarm. Only one write or one
+// alarm is pending at any moment, so the reactor needs no lock.
+template <typename Reply>
+class callback_stream_reactor : public ::grpc::ServerWriteReactor<Reply>
+{
+public:
+    callback_stream_reactor(metric_method method, chr::microseconds interval, const admission_options& admission) :
+        _metrics(metric_side::SERVER, method, state_names),
+        _interval(interval),
+        _rate(admission.message_limit())
+    {
+        _metrics.start();
+    }
+
+    callback_stream_reactor(const callback_stream_reactor&) = delete;
+    callback_stream_reactor& operator=(const callback_stream_reactor&) = delete;
+
+    // 'empty_first': the stream opens with an empty message, as the queue handlers do
+    void start(bool empty_first)
+    {
+        _metrics.state_done(_state);
+        if (empty_first) {
+            _state = handler_state::WRITE;
+            this->StartWrite(&_reply);
+        } else {
+            next();
+        }
+    }
+
+    void OnWriteDone(bool ok) override
+    {
+        _metrics.state_done(_state);
+
+        if (!ok) {
+            LOG_DEBUG("callback_stream_reactor::OnWriteDone(): abort: call is cancelled or connection is dropped");
+            // OnCancel may come too, whichever is first counts the failure
+            if (!_cancelled.exchange(true))
+                _metrics.fail();
+            _state = handler_state::FINISH;
+            this->Finish(::grpc::Status::CANCELLED);
+            return;
+        }
+
+        _metrics.sent();
+
+        // a message over the rate limit waits for its token on top of the pacing
+        const bool paced = _interval.count() > 0 && !_write_now;
+        const auto now = chr::system_clock::now();
+        const auto due = _rate.reserve(paced ? next_tick(_next_write, _interval) : now);
+        if (!paced && due == now) {
+            next();
+            return;
+        }
+
+        _state = handler_state::PACE;
+        _pacing = true;
+        set_alarm(_alarm, due, [this](bool ok) {
+            _pacing = false;
+            _metrics.state_done(_state);
+            if (!ok || _cancelled) {
+                _state = handler_state::FINISH;
+                this->Finish(::grpc::Status::CANCELLED);
+                return;
+            }
+            next();
+        });
+    }
+
+    // a paced stream stops now instead of at its next write, OnDone waits for OnCancel to return
+    void OnCancel() override
+    {
+        if (!_cancelled.exchange(true))
+            _metrics.fail();
+        if (_pacing)
+            _alarm.Cancel();
+    }
+
+    void OnDone() override
+    {
+        // WriteAndFinish reports no write completion, its message counts once the call is done
+        if (_write_and_finish && !_cancelled)
+            _metrics.sent();
+        delete this;
+    }
+
+    // admitted before the reactor was built, counts the stream against the limits of its name and peer while it lives
+    admission_ticket ticket;
+
+protected:
+    // fills _reply with the next message, returns true when it is the last one
+    virtual bool produce() = 0;
+
+    Reply _reply;
+    ::grpc::WriteOptions _write_options;
+    // skips pacing once, for streams that still have data to send right after a write
+    bool _write_now = false;
+
+private:
+    void next()
+    {
+        if (produce()) {
+            _state = handler_state::FINISH;
+            _write_and_finish = true;
+            this->StartWriteAndFinish(&_reply, ::grpc::WriteOptions(), ::grpc::Status::OK);
+            return;
+        }
+
+        _state = handler_state::WRITE;
+        this->StartWrite(&_reply, _write_options);
+    }
+
+    enum class handler_state
+    {
+        CALL,
+        WRITE,
+        PACE,
+        FINISH
+    };
+    static constexpr const char* state_names[] = {"CALL", "WRITE", "PACE", "FINISH", nullptr};
+
+    handler_state _state = handler_state::CALL;
+    call_metrics _metrics;
+
+    ::grpc::Alarm _alarm;
+    const chr::microseconds _interval;
+    chr::system_clock::time_point _next_write;
+    token_bucket _rate;
+    bool _write_and_finish = false;
+    // OnCancel runs on any thread of grpc, concurrently with the alarm; set by a failed write too
+    std::atomic<bool> _cancelled{false};
+    std::atomic<bool> _pacing{false};
+};
+
+// Values of one name, the encoded values come from the reply cache like the ones of the queue engine topics and get
+// their seq and send time appended. The countdown belongs to the call, a resumed call regenerates the values it missed.
+class stream_string_reactor : public callback_stream_reactor<::grpc::ByteBuffer>
+{
+public:
+    explicit stream_string_reactor(callback_service* service) :
+        callback_stream_reactor<::grpc::ByteBuffer>(metric_method::STREAM_STRING,
+                                                    service->options.stream_interval,
+                                                    service->options.admission),
+        _service(service),
+        _amount(std::max<std::size_t>(1, service->options.stream_length))
+    {}
+
+    // skips the values up to seq 'after', a call resumed after the last one gets the last one again
+    void resume(uint64_t after)
+    {
+        const auto skipped = static_cast<std::size_t>(std::min<uint64_t>(after, _amount - 1));
+        _amount -= skipped;
+        _seq = skipped;
+    }
+
+private:
+    bool produce() override
+    {
+        const auto value = std::to_string(_amount--);
+        const auto cached = _service->cached_reply<proto::StringReply>(
+            value, [&value](proto::StringReply& reply) { reply.set_msg(value); });
+        _reply = append_uint64_fields(cached,
+                                      {proto::StringReply::kSeqFieldNumber, ++_seq},
+                                      {proto::StringReply::kSentAtNsFieldNumber, wall_clock_ns()},
+                                      _slices);
+        return _amount == 0;
+    }
+
+    callback_service* _service;
+    std::size_t _amount;
+    uint64_t _seq = 0;
+    std::vector<::grpc::Slice> _slices;
+};
+
+class stream_int_reactor : public callback_stream_reactor<proto::IntReply>
+{
+public:
+    explicit stream_int_reactor(const server_options& options) :
+        callback_stream_reactor<proto::IntReply>(metric_method::STREAM_INT, options.stream_interval, options.admission),
+        _amount(options.stream_length)
+    {}
+
+    // skips the values up to seq 'after', as countdown_producer does
+    void resume(uint64_t after)
+    {
+        const auto skipped = static_cast<std::size_t>(std::min<uint64_t>(after, _amount));
+        _amount -= skipped;
+        _seq = skipped;
+    }
+
+private:
+    bool produce() override
+    {
+        // the last value goes once more with the end of the stream, as with the queue handler
+        if (_amount == 0)
+            return true;
+
+        _reply.set_msg(static_cast<int32_t>(_amount--));
+        _reply.set_seq(++_seq);
+        _reply.set_sent_at_ns(wall_clock_ns());
+        return false;
+    }
+
+    std::size_t _amount;
+    uint64_t _seq = 0;
+};
+
+class stream_string_batch_reactor : public callback_stream_reactor<proto::StringBatchReply>
+{
+public:
+    explicit stream_string_batch_reactor(const server_options& options) :
+        callback_stream_reactor<proto::StringBatchReply>(metric_method::STREAM_STRING_BATCH,
+                                                         batch_coalescer(options).write_interval(),
+                                                         options.admission),
+        _coalescer(options),
+        _amount(options.stream_length)
+    {}
+
+private:
+    bool produce() override
+    {
+        const auto count = std::min(_amount, _coalescer.take(chr::system_clock::now()));
+
+        _reply.Clear();
+        for (std::size_t i = 0; i < count; ++i)
+            _reply.add_msg(std::to_string(_amount--));
+        _reply.set_sent_at_ns(wall_clock_ns());
+
+        // the next batch follows right away, let grpc coalesce both into one frame
+        _write_now = _coalescer.backlog();
+        _write_options = ::grpc::WriteOptions();
+        if (_write_now)
+            _write_options.set_buffer_hint();
+        return _amount == 0;
+    }
+
+    batch_coalescer _coalescer;
+    std::size_t _amount;
+};
+
+class stream_int_batch_reactor : public callback_stream_reactor<proto::IntBatchReply>
+{
+public:
+    explicit stream_int_batch_reactor(const server_options& options) :
+        callback_stream_reactor<proto::IntBatchReply>(metric_method::STREAM_INT_BATCH,
+                                                      batch_coalescer(options).write_interval(),
+                                                      options.admission),
+        _coalescer(options),
+        _amount(options.stream_length)
+    {}
+
+private:
+    bool produce() override
+    {
+        const auto count = std::min(_amount, _coalescer.take(chr::system_clock::now()));
+
+        _reply.Clear();
+        _reply.mutable_msg()->Reserve(static_cast<int>(count));
+        for (std::size_t i = 0; i < count; ++i)
+            _reply.add_msg(static_cast<int32_t>(_amount--));
+        _reply.set_sent_at_ns(wall_clock_ns());
+
+        _write_now = _coalescer.backlog();
+        _write_options = ::grpc::WriteOptions();
+        if (_write_now)
+            _write_options.set_buffer_hint();
+        return _amount == 0;
+    }
+
+    batch_coalescer _coalescer;
+    std::size_t _amount;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// many-to-many reactor
+
+// Reads, writes and the production alarm of the call complete on different threads of grpc, a mutex orders them.
+// Every request restarts the countdown for its name.
+template <typename Reply>
+class callback_bidi_reactor : public ::grpc::ServerBidiReactor<proto::NameRequest, Reply>
+{
+public:
+    callback_bidi_reactor(callback_service* service, metric_method method) :
+        _service(service),
+        _metrics(metric_side::SERVER, method, state_names),
+        _send_queue(service->options.send_queue, _send_queue_stats),
+        _interval(service->options.stream_interval)
+    {
+        _metrics.start();
+        _state = handler_state::STREAM;
+        this->StartRead(&_request);
+    }
+
+    callback_bidi_reactor(const callback_bidi_reactor&) = delete;
+    callback_bidi_reactor& operator=(const callback_bidi_reactor&) = delete;
+
+    void OnReadDone(bool ok) override
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (!ok) {
+            // client half-closed or the call is gone
+            _reads_done = true;
+            try_finish();
+            finish_unlocked(lock);
+            return;
+        }
+
+        LOG_DEBUG("callback_bidi_reactor::OnReadDone(): subscribe '%s'", _request.name().c_str());
+        _metrics.received();
+        _key = _request.name();
+        _amount = _service->options.stream_length;
+
+        // an idle producer starts right away, a running one picks the new request up with its next value
+        if (!_producing && !_writes_failed) {
+            _producing = true;
+            produce_next();
+        }
+
+        this->StartRead(&_request);
+        finish_unlocked(lock);
+    }
+
+    void OnWriteDone(bool ok) override
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _writing = false;
+
+        if (!ok) {
+            LOG_DEBUG("callback_bidi_reactor::OnWriteDone(): call is cancelled or connection is dropped");
+            // OnCancel may come too, whichever is first counts the failure
+            if (!_writes_failed)
+                _metrics.fail();
+            _writes_failed = true;
+            // a pending alarm stops the producer itself
+            if (!_alarm_set)
+                _producing = false;
+            try_finish();
+            finish_unlocked(lock);
+            return;
+        }
+
+        _metrics.sent();
+        if (!_send_queue.empty() && !_writes_failed)
+            write();
+
+        if (_producing && !_alarm_set && (_blocked || _interval.count() == 0))
+            produce_next();
+
+        try_finish();
+        finish_unlocked(lock);
+    }
+
+    // nothing more is produced, the pending read fails by itself and the alarm is cancelled
+    void OnCancel() override
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        LOG_DEBUG("callback_bidi_reactor::OnCancel(): stop producing");
+        if (!_writes_failed)
+            _metrics.fail();
+        _writes_failed = true;
+        const bool pacing = _alarm_set;
+        try_finish();
+        finish_unlocked(lock);
+
+        // the alarm callback takes the lock, OnDone waits for OnCancel to return
+        if (pacing)
+            _alarm.Cancel();
+    }
+
+    void OnDone() override
+    {
+        _service->merge_send_queue_stats(_send_queue_stats);
+        delete this;
+    }
+
+protected:
+    // fills the message of the countdown 'value'
+    virtual void produce(std::size_t value, Reply& reply) = 0;
+
+private:
+    // called with the lock held, as are write() and try_finish(): takes one value and schedules the next one
+    void produce_next()
+    {
+        _alarm_set = false;
+
+        if (!_producing || _writes_failed) {
+            _producing = false;
+            try_finish();
+            return;
+        }
+
+        // a blocked producer still holds its last value in _reply
+        if (!_blocked) {
+            if (_amount == 0) {
+                _producing = false;
+                try_finish();
+                return;
+            }
+            produce(_amount--, _reply);
+        }
+
+        _blocked = !_send_queue.push(_key, std::move(_reply));
+        if (_blocked) {
+            LOG_TRACE("callback_bidi_reactor::produce_next(): send queue is full, pause");
+            return;
+        }
+
+        if (!_writing)
+            write();
+
+        // back-to-back streams produce the next value when this one is written
+        if (_interval.count() == 0)
+            return;
+
+        _alarm_set = true;
+        set_alarm(_alarm, next_tick(_next_value, _interval), [this](bool) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            produce_next();
+            finish_unlocked(lock);
+        });
+    }
+
+    void write()
+    {
+        _writing = true;
+        std::swap(_in_flight, _send_queue.front());
+        _send_queue.pop();
+        this->StartWrite(&_in_flight);
+    }
+
+    // the call is finished once the client half-closed and every produced value is written
+    void try_finish()
+    {
+        if (!_reads_done || _producing || _writing || _alarm_set || _state != handler_state::STREAM)
+            return;
+
+        if (!_send_queue.empty() && !_writes_failed)
+            return;
+
+        _metrics.state_done(_state);
+        _state = handler_state::FINISH;
+        _finish_pending = true;
+    }
+
+    // OnDone may run as soon as Finish is called and destroys the reactor, so Finish goes after the lock is released
+    void finish_unlocked(std::unique_lock<std::mutex>& lock)
+    {
+        const bool finish = _finish_pending;
+        _finish_pending = false;
+        lock.unlock();
+        if (finish)
+            this->Finish(::grpc::Status::OK);
+    }
+
+    enum class handler_state
+    {
+        CALL,
+        STREAM,
+        FINISH
+    };
+    static constexpr const char* state_names[] = {"CALL", "STREAM", "FINISH", nullptr};
+
+    callback_service* _service;
+    std::mutex _mutex;
+    handler_state _state = handler_state::CALL;
+    call_metrics _metrics;
+
+    proto::NameRequest _request;
+    std::string _key;
+    std::size_t _amount = 0;
+
+    // a reactor may run on any thread of grpc, its counters are merged into the service when it is done
+    send_queue_stats _send_queue_stats;
+    send_queue<Reply> _send_queue;
+    // StartWrite needs the message until OnWriteDone
+    Reply _in_flight;
+    Reply _reply;
+
+    bool _reads_done = false;
+    bool _writing = false;
+    bool _writes_failed = false;
+    bool _producing = false;
+    // BLOCK policy: the queue was full, production waits for the next write completion
+    bool _blocked = false;
+
+    bool _finish_pending = false;
+
+    ::grpc::Alarm _alarm;
+    bool _alarm_set = false;
+    const chr::microseconds _interval;
+    chr::system_clock::time_point _next_value;
+};
+
+class bi_stream_string_reactor : public callback_bidi_reactor<proto::StringReply>
+{
+public:
+    explicit bi_stream_string_reactor(callback_service* service) :
+        callback_bidi_reactor<proto::StringReply>(service, metric_method::BI_STREAM_STRING)
+    {}
+
+private:
+    void produce(std::size_t value, proto::StringReply& reply) override { reply.set_msg(std::to_string(value)); }
+};
+
+class bi_stream_int_reactor : public callback_bidi_reactor<proto::IntReply>
+{
+public:
+    explicit bi_stream_int_reactor(callback_service* service) :
+        callback_bidi_reactor<proto::IntReply>(service, metric_method::BI_STREAM_INT)
+    {}
+
+private:
+    void produce(std::size_t value, proto::IntReply& reply) override { reply.set_msg(static_cast<int32_t>(value)); }
+};
+
+} // namespace
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+callback_service::callback_service(const server_options& options, std::shared_ptr<admission_control> admission) :
+    options(options),
+    _admission(std::move(admission)),
+    _replies(options.reply_cache_size)
+{
+    LOG_INFO("callback_service::ctor()");
+}
+
+::grpc::ServerUnaryReactor* callback_service::Ping(callback_server_context* context,
+                                                   const ::grpc::ByteBuffer*,
+                                                   ::grpc::ByteBuffer* reply)
+{
+    LOG_TRACE("callback_service::Ping()");
+
+    auto* reactor = new callback_unary_reactor(metric_method::PING);
+    const auto admitted = _admission->admit_call(*context);
+    if (!admitted.ok()) {
+        reactor->reject(admitted);
+        return reactor;
+    }
+
+    *reply = cached_reply<proto::StringReply>("ping", [](proto::StringReply& pong) { pong.set_msg("pong"); });
+    reactor->Finish(::grpc::Status::OK);
+    return reactor;
+}
+
+::grpc::ServerUnaryReactor* callback_service::Stats(callback_server_context*,
+                                                    const proto::EmptyRequest*,
+                                                    proto::StatsReply* reply)
+{
+    LOG_TRACE("callback_service::Stats()");
+
+    auto* reactor = new callback_unary_reactor(metric_method::STATS);
+    fill_stats_reply(server_engine::CALLBACK, *reply);
+    reactor->Finish(::grpc::Status::OK);
+    return reactor;
+}
+
+::grpc::ServerWriteReactor<::grpc::ByteBuffer>* callback_service::StreamString(callback_server_context* context,
+                                                                               const ::grpc::ByteBuffer* request)
+{
+    using rejected = rejected_stream_reactor<::grpc::ByteBuffer>;
+
+    proto::NameRequest name;
+    auto buffer = *request;
+    if (!::grpc::SerializationTraits<proto::NameRequest>::Deserialize(&buffer, &name).ok()) {
+        LOG_WARN("callback_service::StreamString(): malformed request");
+        return new rejected(metric_method::STREAM_STRING,
+                            ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "malformed request"));
+    }
+
+    LOG_TRACE("callback_service::StreamString(name=%s)", name.name().c_str());
+    admission_ticket ticket;
+    const auto admitted = _admission->admit_stream(name.name(), *context, ticket);
+    if (!admitted.ok())
+        return new rejected(metric_method::STREAM_STRING, admitted);
+
+    auto* reactor = new stream_string_reactor(this);
+    reactor->ticket = std::move(ticket);
+    reactor->resume(name.resume_after());
+    reactor->start(false);
+    return reactor;
+}
+
+::grpc::ServerWriteReactor<proto::IntReply>* callback_service::StreamInt(callback_server_context* context,
+                                                                         const proto::NameRequest* request)
+{
+    LOG_TRACE("callback_service::StreamInt(name=%s)", request->name().c_str());
+
+    admission_ticket ticket;
+    const auto admitted = _admission->admit_stream(request->name(), *context, ticket);
+    if (!admitted.ok())
+        return new rejected_stream_reactor<proto::IntReply>(metric_method::STREAM_INT, admitted);
+
+    auto* reactor = new stream_int_reactor(options);
+    reactor->ticket = std::move(ticket);
+    reactor->resume(request->resume_after());
+    reactor->start(true);
+    return reactor;
+}
+
+::grpc::ServerWriteReactor<proto::StringBatchReply>* callback_service::StreamStringBatch(
+    callback_server_context* context, const proto::NameRequest* request)
+{
+    LOG_TRACE("callback_service::StreamStringBatch(name=%s)", request->name().c_str());
+
+    admission_ticket ticket;
+    const auto admitted = _admission->admit_stream(request->name(), *context, ticket);
+    if (!admitted.ok())
+        return new rejected_stream_reactor<proto::StringBatchReply>(metric_method::STREAM_STRING_BATCH, admitted);
+
+    auto* reactor = new stream_string_batch_reactor(options);
+    reactor->ticket = std::move(ticket);
+    reactor->start(true);
+    return reactor;
+}
+
+::grpc::ServerWriteReactor<proto::IntBatchReply>* callback_service::StreamIntBatch(callback_server_context* context,
+                                                                                   const proto::NameRequest* request)
+{
+    LOG_TRACE("callback_service::StreamIntBatch(name=%s)", request->name().c_str());
+
+    admission_ticket ticket;
+    const auto admitted = _admission->admit_stream(request->name(), *context, ticket);
+    if (!admitted.ok())
+        return new rejected_stream_reactor<proto::IntBatchReply>(metric_method::STREAM_INT_BATCH, admitted);
+
+    auto* reactor = new stream_int_batch_reactor(options);
+    reactor->ticket = std::move(ticket);
+    reactor->start(true);
+    return reactor;
+}
+
+::grpc::ServerBidiReactor<proto::NameRequest, proto::StringReply>* callback_service::BiStreamString(
+    callback_server_context*)
+{
+    LOG_TRACE("callback_service::BiStreamString()");
+    return new bi_stream_string_reactor(this);
+}
+
+::grpc::ServerBidiReactor<proto::NameRequest, proto::IntReply>* callback_service::BiStreamInt(
+    callback_server_context*)
+{
+    LOG_TRACE("callback_service::BiStreamInt()");
+    return new bi_stream_int_reactor(this);
+}
+
+void callback_service::merge_send_queue_stats(const send_queue_stats& stats)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _send_queues.pushed += stats.pushed;
+    _send_queues.dropped += stats.dropped;
+    _send_queues.conflated += stats.conflated;
+    _send_queues.max_depth = std::max(_send_queues.max_depth, stats.max_depth);
+}
+
+void callback_service::log_stats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    LOG_INFO("callback_service::log_stats(): send queues: pushed %lu, dropped %lu, conflated %lu, max depth %lu",
+             _send_queues.pushed,
+             _send_queues.dropped,
+             _send_queues.conflated,
+             _send_queues.max_depth);
+    LOG_INFO("callback_service::log_stats(): reply cache: %zu entries, hits %lu, misses %lu, evicted %lu",
+             _replies.size(),
+             _replies.stats.hits,
+             _replies.stats.misses,
+             _replies.stats.evicted);
+}
+
+} // namespace frankenstein
@@ -0,0 +1,60 @@
+#include <frankenstein/channel_pool.hpp>
+
+#include <algorithm>
+
+#include <grpcpp/grpcpp.h>
+
+namespace frankenstein {
+
+bool from_string(const std::string& name, channel_selection& selection)
+{
+    if (name == "round-robin")
+        selection = channel_selection::ROUND_ROBIN;
+    else if (name == "least-outstanding")
+        selection = channel_selection::LEAST_OUTSTANDING;
+    else
+        return false;
+
+    return true;
+}
+
+channel_factory remote_channels(const std::string& target)
+{
+    return [target](const ::grpc::ChannelArguments& args) {
+        return ::grpc::CreateCustomChannel(target, ::grpc::InsecureChannelCredentials(), args);
+    };
+}
+
+channel_pool::channel_pool(const channel_factory& factory, const channel_options& options) :
+    _selection(options.selection),
+    _channels(std::max<std::size_t>(1, options.channels))
+{
+    for (std::size_t i = 0; i < _channels.size(); ++i) {
+        ::grpc::ChannelArguments args;
+        // equal args would let grpc share one subchannel (one connection) between the channels
+        args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+        args.SetInt("frankenstein.channel_index", static_cast<int>(i));
+
+        _channels[i].stub = proto::ExchangeService::NewStub(factory(args));
+    }
+}
+
+pooled_stub channel_pool::pick()
+{
+    const auto count = _channels.size();
+    auto index = _next % count;
+    if (_selection == channel_selection::LEAST_OUTSTANDING) {
+        // scanning from the round-robin position spreads the calls of an idle pool as well
+        for (std::size_t i = 1; i < count; ++i) {
+            const auto candidate = (_next + i) % count;
+            if (_channels[candidate].outstanding < _channels[index].outstanding)
+                index = candidate;
+        }
+    }
+    ++_next;
+
+    auto& channel = _channels[index];
+    return pooled_stub(channel.stub, &channel.outstanding);
+}
+
+} // namespace frankenstein
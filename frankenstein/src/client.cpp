@@ -1,47 +1,133 @@
 #include <frankenstein/client.hpp>
 
 #include <chrono>
+#include <stdexcept>
 
 namespace frankenstein {
 
 namespace chr = std::chrono;
 
-client::client(uint16_t port) :
-    _port(port),
+bool call_deadlines::set(const std::string& spec)
+{
+    const auto equals = spec.find('=');
+    if (equals == std::string::npos)
+        return false;
+
+    const auto name = spec.substr(0, equals);
+    const auto value = spec.substr(equals + 1);
+
+    std::chrono::milliseconds deadline;
+    try {
+        std::size_t parsed = 0;
+        deadline = std::chrono::milliseconds(std::stoul(value, &parsed));
+        if (parsed != value.size())
+            return false;
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    for (std::size_t i = 0; i < methods.size(); ++i) {
+        if (name == to_string(static_cast<metric_method>(i))) {
+            methods[i] = deadline;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+namespace {
+
+// channels to the server on 'port' of this host, an in-process server has no port to dial
+channel_factory port_channels(uint16_t port, const transport_options& transport)
+{
+    if (transport.kind == transport_kind::IN_PROCESS)
+        throw std::invalid_argument("in-process transport has no port to dial, the channels must come from the server");
+
+    return remote_channels(transport_address(transport, "0.0.0.0:" + std::to_string(port)));
+}
+
+} // namespace
+
+client::client(uint16_t port, client_options options) : client(port_channels(port, options.transport), options) {}
+
+client::client(channel_factory channels, client_options options) :
+    _options(options),
     _timer(this),
-    _stub(proto::ExchangeService::NewStub(
-        ::grpc::CreateChannel("0.0.0.0:" + std::to_string(_port), ::grpc::InsecureChannelCredentials()))),
+    _channels(channels, _options.channel),
     _queue(std::make_shared<::grpc::CompletionQueue>()),
-    _string_container(_stub, _queue),
-    _int_container(_stub, _queue)
+    _string_container(_channels, _queue, _options.arena, _options.deadlines, _options.resume),
+    _int_container(_channels, _queue, _options.arena, _options.deadlines, _options.resume),
+    _string_batch_container(_channels, _queue, _options.arena, _options.deadlines, _options.resume),
+    _int_batch_container(_channels, _queue, _options.arena, _options.deadlines, _options.resume),
+    _string_subscriptions(_channels, _queue, _options.arena, _options.deadlines),
+    _int_subscriptions(_channels, _queue, _options.arena, _options.deadlines)
 {
-    LOG("client::ctor()");
+    LOG_INFO("client::ctor(transport=%s)", to_string(_options.transport.kind));
 
     connect(&_timer, &QTimer::timeout, this, &client::poll);
     connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &client::stop);
 
-    _timer.start();
+    if (_options.mode == client_mode::EVENT) {
+        _dispatcher = std::make_unique<queue_dispatcher>(_queue, _options.batch_size);
+        connect(_dispatcher.get(), &queue_dispatcher::ready, this, &client::dispatch, Qt::QueuedConnection);
+        _dispatcher->start();
+    } else {
+        _timer.start();
+    }
 }
 
 client::~client()
 {
-    LOG("client::dtor()");
+    LOG_INFO("client::dtor()");
     stop();
 }
 
 void client::stop()
 {
-    LOG("client::stop()");
+    LOG_INFO("client::stop()");
 
     if (_queue)
         _queue->Shutdown();
 
     _timer.stop();
+
+    if (_dispatcher)
+        _dispatcher->stop();
+
+    LOG_INFO("client::stop(): pools hits/misses: ping %lu/%lu, stream_string %lu/%lu, stream_int %lu/%lu, "
+             "stream_string_batch %lu/%lu, stream_int_batch %lu/%lu, bi_stream_string %lu/%lu, bi_stream_int %lu/%lu",
+             _ping_handlers.hits(),
+             _ping_handlers.misses(),
+             _string_container.pool().hits(),
+             _string_container.pool().misses(),
+             _int_container.pool().hits(),
+             _int_container.pool().misses(),
+             _string_batch_container.pool().hits(),
+             _string_batch_container.pool().misses(),
+             _int_batch_container.pool().hits(),
+             _int_batch_container.pool().misses(),
+             _string_subscriptions.pool().hits(),
+             _string_subscriptions.pool().misses(),
+             _int_subscriptions.pool().hits(),
+             _int_subscriptions.pool().misses());
+    LOG_INFO("client::stop(): streams resumed: stream_string %lu, stream_int %lu",
+             _string_container.resumed(),
+             _int_container.resumed());
+
+#ifdef FRANKENSTEIN_COROUTINES
+    LOG_INFO("client::stop(): coroutine frames hits/misses: %lu/%lu", _frames.hits(), _frames.misses());
+#endif
+
+    for (const auto& line : metrics::snapshot().to_lines(metric_side::CLIENT))
+        LOG_INFO("metrics: %s", line.c_str());
 }
 
 void client::poll()
 {
-    // LOG("client::poll()");
+    // LOG_TRACE("client::poll()");
 
     void* tag;
     bool ok = false;
@@ -54,203 +140,192 @@ void client::poll()
     if (status == ::grpc::CompletionQueue::TIMEOUT || status == ::grpc::CompletionQueue::SHUTDOWN)
         return;
 
+    metrics::local()[metric_side::CLIENT].queue_events.add();
     auto* handler = static_cast<client_method_handler_stub*>(tag);
     handler->proceed(ok);
 }
 
+void client::dispatch()
+{
+    _dispatcher->take(_events);
+    metrics::local()[metric_side::CLIENT].queue_events.add(_events.size());
+
+    for (const auto& event : _events)
+        static_cast<client_method_handler_stub*>(event.tag)->proceed(event.ok);
+}
+
 void client::send_ping(int msec)
 {
-    LOG("client::send_ping()");
+    LOG_DEBUG("client::send_ping()");
     QTimer::singleShot(msec, [this]() {
-        LOG("client::send_ping(): create handler");
+        LOG_DEBUG("client::send_ping(): create handler");
         proto::EmptyRequest req;
-        new ping_client_handler(req, _stub, _queue);
+        _ping_handlers.create(req, _channels.pick(), _queue, _options.arena, _options.deadlines, _ping_handlers);
     });
 }
 
 void client::create_stream_string(const std::string& name, int msec)
 {
-    LOG("client::create_stream_string()");
+    LOG_DEBUG("client::create_stream_string()");
     _string_container.create(name, msec);
 }
 
 void client::create_stream_int(const std::string& name, int msec)
 {
-    LOG("client::create_stream_int()");
+    LOG_DEBUG("client::create_stream_int()");
+#ifdef FRANKENSTEIN_COROUTINES
+    QTimer::singleShot(msec, [this, name]() {
+        proto::NameRequest request;
+        request.set_name(name);
+        stream_int_client_coroutine(_frames,
+                                    _channels.pick(),
+                                    _queue,
+                                    _options.deadlines,
+                                    std::move(request),
+                                    _int_container.sink(),
+                                    _int_coroutines);
+    });
+#else
     _int_container.create(name, msec);
+#endif
 }
 
-// ---------------------------------------------------------------------------------------------------------------------
-
-ping_client_handler::ping_client_handler(const request_type& request, stub_ptr stub, grpc_client_queue_ptr queue) :
-    client_method_handler_oto<request_type, reply_type>()
-{
-    LOG("ping_client_handler::ctor()");
-    _reader = stub->AsyncPing(&_context, request, queue.get());
-    _reader->Finish(&_reply, &_status, reinterpret_cast<void*>(this));
-}
-
-ping_client_handler::~ping_client_handler()
-{
-    LOG("ping_client_handler::dtor()");
-}
-
-bool ping_client_handler::proceed(bool ok)
-{
-    LOG("ping_client_handler::proceed()");
-
-    if (!ok) {
-        LOG("ping_client_handler::proceed(): ok=false");
-        return false;
-    }
-
-    if (_status.ok()) {
-        LOG("ping_client_handler::proceed(): status success");
-        LOG("result: " + _reply.msg());
-    } else {
-        LOG("ping_client_handler::proceed(): status fail");
-    }
-
-    delete this;
-    return true;
-}
-
-// ---------------------------------------------------------------------------------------------------------------------
-
-stream_string_client_handler::stream_string_client_handler(const request_type& request,
-                                                           stub_ptr stub,
-                                                           grpc_client_queue_ptr queue) :
-    client_method_handler_otm<proto::NameRequest, proto::StringReply>(request, stub, queue)
+void client::create_stream_string_batch(const std::string& name, int msec)
 {
-    LOG("stream_string_client_handler::ctor()");
-
-    proceed(true);
+    LOG_DEBUG("client::create_stream_string_batch()");
+    _string_batch_container.create(name, msec);
 }
 
-stream_string_client_handler::~stream_string_client_handler()
+void client::create_stream_int_batch(const std::string& name, int msec)
 {
-    LOG("stream_string_client_handler::dtor()");
+    LOG_DEBUG("client::create_stream_int_batch()");
+    _int_batch_container.create(name, msec);
 }
 
-void stream_string_client_handler::handle_call_state()
+void client::subscribe_string(const std::string& name, int msec)
 {
-    LOG("stream_string_client_handler::handle_call_state()");
-
-    _reader = _stub->PrepareAsyncStreamString(&_context, _request, _queue.get());
-    _state = handler_state::WRITE;
-    _reader->StartCall(this);
+    LOG_DEBUG("client::subscribe_string()");
+    _string_subscriptions.subscribe(name, msec);
 }
 
-void stream_string_client_handler::handle_write_state()
+void client::subscribe_int(const std::string& name, int msec)
 {
-    LOG("stream_string_client_handler::handle_write_state()");
-
-    _state = handler_state::WAIT;
-    _reader->Read(&_reply, this);
+    LOG_DEBUG("client::subscribe_int()");
+    _int_subscriptions.subscribe(name, msec);
 }
 
-void stream_string_client_handler::handle_wait_state()
+void client::unsubscribe(int msec)
 {
-    LOG("stream_string_client_handler::handle_wait_state()");
-
-    // if (_reply validate) {
-    _state = handler_state::READ;
-    _reply.Clear();
-    _reader->Read(&_reply, this);
-    // }
-    // else {
-    //     state_ = handler_state::FINISH;
-    //     _reader->Finish(&_status, this);
-    // }
+    LOG_DEBUG("client::unsubscribe()");
+    _string_subscriptions.close(msec);
+    _int_subscriptions.close(msec);
 }
 
-void stream_string_client_handler::handle_read_state()
+void client::set_reply_sink(std::shared_ptr<reply_sink<proto::StringReply>> sink)
 {
-    LOG("stream_string_client_handler::handle_read_state()");
-    LOG("result: " + _reply.msg());
-
-    if (_reply.msg() != "1")
-        _state = handler_state::READ;
-    else
-        _state = handler_state::FINISH;
-
-    _reply.Clear();
-    _reader->Read(&_reply, this);
+    LOG_DEBUG("client::set_reply_sink(string)");
+    _string_container.set_sink(sink);
+    _string_batch_container.set_sink(sink);
+    _string_subscriptions.set_sink(sink);
 }
 
-void stream_string_client_handler::handle_finish_state()
+void client::set_reply_sink(std::shared_ptr<reply_sink<proto::IntReply>> sink)
 {
-    LOG("stream_string_client_handler::handle_finish_state()");
-    _state = handler_state::CLOSED;
+    LOG_DEBUG("client::set_reply_sink(int)");
+    _int_container.set_sink(sink);
+    _int_batch_container.set_sink(sink);
+    _int_subscriptions.set_sink(sink);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 
-stream_int_client_handler::stream_int_client_handler(const request_type& request,
-                                                     stub_ptr stub,
-                                                     grpc_client_queue_ptr queue) :
-    client_method_handler_otm<proto::NameRequest, proto::IntReply>(request, stub, queue)
+ping_client_handler::ping_client_handler(const request_type& request,
+                                         pooled_stub stub,
+                                         grpc_client_queue_ptr queue,
+                                         const arena_options& arena,
+                                         const call_deadlines& deadlines,
+                                         pool_type& pool) :
+    client_method_handler_oto<request_type, reply_type>(std::move(stub), arena, deadlines, metric_method::PING),
+    _pool(pool)
 {
-    LOG("stream_int_client_handler::ctor()");
-
-    proceed(true);
+    LOG_TRACE("ping_client_handler::ctor()");
+    _reader = _stub->AsyncPing(&_context, request, queue.get());
+    _reader->Finish(_reply.get(), &_status, reinterpret_cast<void*>(this));
 }
 
-stream_int_client_handler::~stream_int_client_handler()
+ping_client_handler::~ping_client_handler()
 {
-    LOG("stream_int_client_handler::dtor()");
+    LOG_TRACE("ping_client_handler::dtor()");
 }
 
-void stream_int_client_handler::handle_call_state()
+bool ping_client_handler::proceed(bool ok)
 {
-    LOG("stream_int_client_handler::handle_call_state()");
+    LOG_TRACE("ping_client_handler::proceed()");
 
-    _reader = _stub->PrepareAsyncStreamInt(&_context, _request, _queue.get());
-    _state = handler_state::WRITE;
-    _reader->StartCall(this);
-}
+    _metrics.state_done(0);
 
-void stream_int_client_handler::handle_write_state()
-{
-    LOG("stream_int_client_handler::handle_write_state()");
+    if (!ok) {
+        LOG_WARN("ping_client_handler::proceed(): ok=false");
+        _metrics.fail();
+        _pool.destroy(this);
+        return false;
+    }
 
-    _state = handler_state::WAIT;
-    _reader->Read(&_reply, this);
-}
+    if (_status.ok()) {
+        LOG_DEBUG("ping_client_handler::proceed(): status success");
+        LOG_DEBUG("result: %s", _reply->msg().c_str());
+        _metrics.received();
+    } else {
+        LOG_WARN("ping_client_handler::proceed(): status fail");
+        _metrics.fail();
+    }
 
-void stream_int_client_handler::handle_wait_state()
-{
-    LOG("stream_int_client_handler::handle_wait_state()");
-
-    // if (_reply validate) {
-    _state = handler_state::READ;
-    _reply.Clear();
-    _reader->Read(&_reply, this);
-    // }
-    // else {
-    //     state_ = handler_state::FINISH;
-    //     _reader->Finish(&_status, this);
-    // }
+    _pool.destroy(this);
+    return true;
 }
 
-void stream_int_client_handler::handle_read_state()
-{
-    LOG("stream_int_client_handler::handle_read_state()");
-    LOG("result: " + std::to_string(_reply.msg()));
-
-    if (_reply.msg() != 1)
-        _state = handler_state::READ;
-    else
-        _state = handler_state::FINISH;
-
-    _reply.Clear();
-    _reader->Read(&_reply, this);
-}
+// ---------------------------------------------------------------------------------------------------------------------
 
-void stream_int_client_handler::handle_finish_state()
+#ifdef FRANKENSTEIN_COROUTINES
+coroutine_task stream_int_client_coroutine(frame_allocator&,
+                                           pooled_stub stub,
+                                           grpc_client_queue_ptr queue,
+                                           const call_deadlines& deadlines,
+                                           proto::NameRequest request,
+                                           std::shared_ptr<reply_sink<proto::IntReply>> sink,
+                                           coroutine_calls& calls)
 {
-    LOG("stream_int_client_handler::handle_finish_state()");
-    _state = handler_state::CLOSED;
+    using tag = client_method_handler_stub;
+
+    coroutine_calls::call call(calls, request.name(), co_await current_coroutine{});
+    if (const auto deadline = deadlines[metric_method::STREAM_INT]; deadline.count() > 0)
+        call.context.set_deadline(chr::system_clock::now() + deadline);
+    proto::IntReply reply;
+    ::grpc::Status status;
+    call_metrics metrics(metric_side::CLIENT, metric_method::STREAM_INT, nullptr);
+    metrics.start();
+
+    auto reader = stub->PrepareAsyncStreamInt(&call.context, request, queue.get());
+    bool ok = co_await async_start_call<tag>(*reader);
+    // the empty message opening the stream has no seq, the last value comes once more with the end of the stream
+    uint64_t last_seq = request.resume_after();
+    while (ok) {
+        ok = co_await async_read<tag>(*reader, &reply);
+        if (ok && reply.seq() && reply.seq() != last_seq) {
+            metrics.received();
+            LOG_DEBUG("result: %d", reply.msg());
+            last_seq = reply.seq();
+            if (sink)
+                sink->push(request.name(), reply);
+        }
+    }
+
+    co_await async_finish<tag>(*reader, &status);
+    if (!status.ok()) {
+        LOG_DEBUG("stream_int_client_coroutine(name=%s): %s", request.name().c_str(), status.error_message().c_str());
+        metrics.fail();
+    }
 }
+#endif
 
 } // namespace frankenstein
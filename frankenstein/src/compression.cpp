@@ -0,0 +1,170 @@
+#include <frankenstein/compression.hpp>
+
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+#include <zlib.h>
+
+namespace frankenstein {
+
+namespace chr = std::chrono;
+
+bool from_string(const std::string& name, grpc_compression_algorithm& algorithm)
+{
+    if (name == "none")
+        algorithm = GRPC_COMPRESS_NONE;
+    else if (name == "gzip")
+        algorithm = GRPC_COMPRESS_GZIP;
+    else if (name == "deflate")
+        algorithm = GRPC_COMPRESS_DEFLATE;
+    else
+        return false;
+
+    return true;
+}
+
+const char* to_string(grpc_compression_algorithm algorithm)
+{
+    switch (algorithm) {
+        case GRPC_COMPRESS_NONE:
+            return "none";
+        case GRPC_COMPRESS_GZIP:
+            return "gzip";
+        case GRPC_COMPRESS_DEFLATE:
+            return "deflate";
+        default:
+            return "";
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+void compression_options::set_text_methods(grpc_compression_algorithm algorithm, std::size_t threshold)
+{
+    for (const auto method :
+         {metric_method::STREAM_STRING, metric_method::STREAM_STRING_BATCH, metric_method::BI_STREAM_STRING}) {
+        (*this)[method].algorithm = algorithm;
+        (*this)[method].threshold = threshold;
+    }
+}
+
+bool compression_options::set(const std::string& spec)
+{
+    const auto equals = spec.find('=');
+    if (equals == std::string::npos)
+        return false;
+
+    const auto name = spec.substr(0, equals);
+    auto value = spec.substr(equals + 1);
+
+    method_compression compression;
+    const auto colon = value.find(':');
+    if (colon != std::string::npos) {
+        try {
+            std::size_t parsed = 0;
+            compression.threshold = std::stoul(value.substr(colon + 1), &parsed);
+            if (parsed != value.size() - colon - 1)
+                return false;
+        } catch (const std::exception&) {
+            return false;
+        }
+        value.resize(colon);
+    }
+    if (!from_string(value, compression.algorithm))
+        return false;
+
+    for (std::size_t i = 0; i < methods.size(); ++i) {
+        if (name == to_string(static_cast<metric_method>(i))) {
+            methods[i] = compression;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool compression_options::enabled() const
+{
+    for (const auto& method : methods) {
+        if (method.algorithm != GRPC_COMPRESS_NONE)
+            return true;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+double compression_stats::saved_bytes() const
+{
+    if (!sampled_bytes)
+        return 0;
+
+    const double ratio = (static_cast<double>(sampled_bytes) - static_cast<double>(sampled_output)) / sampled_bytes;
+    return ratio * compressed_bytes;
+}
+
+double compression_stats::cpu_seconds() const
+{
+    if (!sampled_bytes)
+        return 0;
+
+    return sampled_ns / 1e9 * compressed_bytes / sampled_bytes;
+}
+
+void compression_stats::merge(const compression_stats& other)
+{
+    compressed += other.compressed;
+    compressed_bytes += other.compressed_bytes;
+    raw += other.raw;
+    raw_bytes += other.raw_bytes;
+    sampled += other.sampled;
+    sampled_bytes += other.sampled_bytes;
+    sampled_output += other.sampled_output;
+    sampled_ns += other.sampled_ns;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+std::string call_compression::serialize(const ::grpc::ByteBuffer& reply)
+{
+    std::vector<::grpc::Slice> slices;
+    std::string data;
+    if (!reply.Dump(&slices).ok())
+        return data;
+
+    data.reserve(reply.Length());
+    for (const auto& slice : slices)
+        data.append(reinterpret_cast<const char*>(slice.begin()), slice.size());
+    return data;
+}
+
+void call_compression::sample(const std::string& data)
+{
+    // same stream parameters as the message compression of grpc, gzip differs by its header only
+    const int window_bits = 15 | (_method.algorithm == GRPC_COMPRESS_GZIP ? 16 : 0);
+
+    const auto begin = chr::steady_clock::now();
+
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+
+    std::vector<Bytef> output(deflateBound(&stream, static_cast<uLong>(data.size())));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = output.data();
+    stream.avail_out = static_cast<uInt>(output.size());
+    const auto result = deflate(&stream, Z_FINISH);
+    const auto output_size = stream.total_out;
+    deflateEnd(&stream);
+
+    if (result != Z_STREAM_END)
+        return;
+
+    ++_stats.sampled;
+    _stats.sampled_bytes += data.size();
+    _stats.sampled_output += output_size;
+    _stats.sampled_ns += chr::duration_cast<chr::nanoseconds>(chr::steady_clock::now() - begin).count();
+}
+
+} // namespace frankenstein
@@ -0,0 +1,80 @@
+#include <frankenstein/dispatcher.hpp>
+
+#include <algorithm>
+
+namespace frankenstein {
+
+queue_dispatcher::queue_dispatcher(grpc_queue_ptr queue, std::size_t batch_size, QObject* parent) :
+    QObject(parent),
+    _queue(std::move(queue)),
+    _batch_size(std::max<std::size_t>(1, batch_size))
+{
+    LOG_INFO("queue_dispatcher::ctor()");
+}
+
+queue_dispatcher::~queue_dispatcher()
+{
+    LOG_INFO("queue_dispatcher::dtor()");
+    stop();
+}
+
+void queue_dispatcher::start()
+{
+    LOG_INFO("queue_dispatcher::start()");
+    _thread = std::thread(&queue_dispatcher::run, this);
+}
+
+void queue_dispatcher::stop()
+{
+    if (_thread.joinable()) {
+        LOG_INFO("queue_dispatcher::stop()");
+        _thread.join();
+    }
+}
+
+void queue_dispatcher::take(std::vector<event>& events)
+{
+    events.clear();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    events.swap(_pending);
+}
+
+void queue_dispatcher::run()
+{
+    std::vector<event> batch;
+    batch.reserve(_batch_size);
+
+    void* tag;
+    bool ok = false;
+
+    while (_queue->Next(&tag, &ok)) {
+        batch.push_back({tag, ok});
+
+        // collect whatever has already completed without blocking again
+        while (batch.size() < _batch_size &&
+               _queue->AsyncNext(&tag, &ok, gpr_time_0(GPR_CLOCK_MONOTONIC)) == ::grpc::CompletionQueue::GOT_EVENT)
+            batch.push_back({tag, ok});
+
+        publish(batch);
+    }
+
+    LOG_INFO("queue_dispatcher::run(): queue is drained");
+}
+
+void queue_dispatcher::publish(std::vector<event>& batch)
+{
+    bool was_empty = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        was_empty = _pending.empty();
+        _pending.insert(_pending.end(), batch.begin(), batch.end());
+    }
+    batch.clear();
+
+    // previous ready() is still queued otherwise
+    if (was_empty)
+        emit ready();
+}
+
+} // namespace frankenstein
@@ -0,0 +1,165 @@
+#include <frankenstein/logging.hpp>
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace frankenstein {
+
+namespace chr = std::chrono;
+
+namespace {
+
+const char* level_name(log_level level)
+{
+    switch (level) {
+        case log_level::TRACE:
+            return "TRACE";
+        case log_level::DEBUG:
+            return "DEBUG";
+        case log_level::INFO:
+            return "INFO ";
+        case log_level::WARN:
+            return "WARN ";
+        case log_level::ERROR:
+            return "ERROR";
+        default:
+            return "";
+    }
+}
+
+} // namespace
+
+std::atomic<int> logger::_level{static_cast<int>(log_level::INFO)};
+
+logger& logger::instance()
+{
+    static logger log;
+    return log;
+}
+
+bool logger::set_level(const char* name)
+{
+    static const std::pair<const char*, log_level> levels[] = {
+        {"trace", log_level::TRACE},
+        {"debug", log_level::DEBUG},
+        {"info", log_level::INFO},
+        {"warn", log_level::WARN},
+        {"error", log_level::ERROR},
+        {"off", log_level::OFF},
+    };
+
+    for (const auto& level : levels) {
+        if (std::strcmp(level.first, name) == 0) {
+            set_level(level.second);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+logger::logger() : _ring(ring_capacity), _thread(&logger::run, this) {}
+
+logger::~logger()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopped.store(true, std::memory_order_relaxed);
+    }
+    _wakeup.notify_one();
+    _thread.join();
+}
+
+void logger::write(log_level level, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+
+    const bool pushed = _ring.try_produce([&](record& rec) {
+        rec.level = level;
+        rec.time = chr::system_clock::now();
+        std::vsnprintf(rec.text, record_size, format, args);
+    });
+
+    va_end(args);
+
+    if (!pushed) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // pairs with the fence in run(): either the writer sees the record or this thread sees it asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _wakeup.notify_one();
+    }
+}
+
+void logger::flush()
+{
+    while (_ring.size() > 0) {
+        _wakeup.notify_one();
+        std::this_thread::yield();
+    }
+
+    // waits for the batch the writer may still be printing
+    std::lock_guard<std::mutex> lock(_writing);
+}
+
+void logger::run()
+{
+    uint64_t reported_drops = 0;
+
+    for (;;) {
+        std::size_t printed = 0;
+        {
+            std::lock_guard<std::mutex> lock(_writing);
+
+            printed = _ring.consume([](record& rec) {
+                const auto time = chr::system_clock::to_time_t(rec.time);
+                const auto usec =
+                    chr::duration_cast<chr::microseconds>(rec.time.time_since_epoch()).count() % 1000000;
+
+                std::tm local{};
+                localtime_r(&time, &local);
+
+                std::fprintf(stdout,
+                             "%02d:%02d:%02d.%06lld [%s] %s\n",
+                             local.tm_hour,
+                             local.tm_min,
+                             local.tm_sec,
+                             static_cast<long long>(usec),
+                             level_name(rec.level),
+                             rec.text);
+            });
+
+            const auto drops = dropped();
+            if (drops != reported_drops) {
+                std::fprintf(stdout, "[WARN ] logger: %llu records dropped\n",
+                             static_cast<unsigned long long>(drops - reported_drops));
+                reported_drops = drops;
+            }
+
+            if (printed)
+                std::fflush(stdout);
+        }
+
+        if (printed)
+            continue;
+
+        if (_stopped.load(std::memory_order_relaxed))
+            break;
+
+        // sleeps until a record arrives, an idle writer costs no wakeups
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        _wakeup.wait(lock, [this]() { return _ring.size() > 0 || _stopped.load(std::memory_order_relaxed); });
+        _sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+} // namespace frankenstein
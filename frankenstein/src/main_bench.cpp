@@ -0,0 +1,86 @@
+#include <cstdio>
+#include <optional>
+
+#include <QtCore/QCommandLineParser>
+
+#include <frankenstein/bench.hpp>
+#include <frankenstein/commons.hpp>
+#include <frankenstein/server.hpp>
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("Frankenstein bench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Load generator for a running Frankenstein server.");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"target", "Server address.", "address", "0.0.0.0:50051"},
+        {"transport",
+         "How to reach the server: tcp (--target), unix:<path> or inprocess (runs a server in this process).",
+         "transport",
+         "tcp"},
+        {"server-engine", "Engine of the in-process server: queue or callback.", "engine", "queue"},
+        {"server-queues",
+         "Completion queues of the in-process queue engine (0 - one per hardware thread).",
+         "count",
+         "0"},
+        {"stream-interval", "Delay between two messages of one stream of the in-process server, microseconds.", "usec",
+         "0"},
+        {"method",
+         "RPC to drive: ping, stream_string, stream_int, stream_string_batch or stream_int_batch.",
+         "method",
+         "ping"},
+        {"concurrency", "Outstanding calls (ping) or open streams.", "count", "16"},
+        {"threads", "Client completion queues, each drained by its own thread.", "count", "1"},
+        {"rate", "New calls per second over all slots, 0 - as fast as possible.", "rate", "0"},
+        {"duration", "Run time in seconds.", "sec", "10"},
+        {"json", "Print the result as a single JSON object."},
+        {"log-level", "Minimal level of log records: trace, debug, info, warn, error or off.", "level", "warn"},
+    });
+    parser.process(app);
+
+    frankenstein::logger::set_level(parser.value("log-level").toStdString().c_str());
+
+    frankenstein::bench_options options;
+    options.target = parser.value("target").toStdString();
+    if (!frankenstein::from_string(parser.value("transport").toStdString(), options.transport)) {
+        std::fprintf(stderr, "unknown transport '%s'\n", parser.value("transport").toStdString().c_str());
+        return 1;
+    }
+    if (!frankenstein::from_string(parser.value("method").toStdString(), options.method)) {
+        std::fprintf(stderr, "unknown method '%s'\n", parser.value("method").toStdString().c_str());
+        return 1;
+    }
+    options.concurrency = std::max(1u, parser.value("concurrency").toUInt());
+    options.threads = std::max(1u, parser.value("threads").toUInt());
+    options.rate = parser.value("rate").toDouble();
+    options.duration = std::chrono::milliseconds(static_cast<int64_t>(parser.value("duration").toDouble() * 1000));
+
+    // in-process: the server shares the process (and its cpu time) with the load, its queues run on their own threads
+    std::optional<frankenstein::server> embedded_server;
+    if (options.transport.kind == frankenstein::transport_kind::IN_PROCESS) {
+        frankenstein::server_options server_options;
+        server_options.transport = options.transport;
+        server_options.mode = frankenstein::server_mode::THREADED;
+        server_options.queues = parser.value("server-queues").toUInt();
+        server_options.stream_interval = std::chrono::microseconds(parser.value("stream-interval").toUInt());
+        if (!frankenstein::from_string(parser.value("server-engine").toStdString(), server_options.engine)) {
+            std::fprintf(stderr, "unknown server engine '%s'\n", parser.value("server-engine").toStdString().c_str());
+            return 1;
+        }
+        embedded_server.emplace(50051, server_options);
+        embedded_server->init();
+    }
+
+    const auto result = embedded_server ? frankenstein::run_bench(options, embedded_server->in_process_channel())
+                                        : frankenstein::run_bench(options);
+
+    if (parser.isSet("json"))
+        std::printf("%s\n", result.to_json().c_str());
+    else
+        std::printf("%s", result.to_text().c_str());
+
+    return result.errors ? 2 : 0;
+}
@@ -1,17 +1,111 @@
+#include <atomic>
 #include <csignal>
+#include <optional>
+#include <thread>
+
+#include <QtCore/QCommandLineParser>
 
 #include <frankenstein/commons.hpp>
 #include <frankenstein/client.hpp>
+#include <frankenstein/server.hpp>
 
 int main(int argc, char** argv)
 {
+    safe_application app(argc, argv);
+    safe_application::setApplicationName("Frankenstein client");
+
+    signal_watcher quit_on_signal;
     std::signal(SIGTERM, signal_handler);
     std::signal(SIGINT, signal_handler);
 
-    safe_application app(argc, argv);
-    safe_application::setApplicationName("Frankenstein client");
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOptions({
+        {"event-dispatch", "Drain the completion queue on a dispatcher thread instead of polling it by timer."},
+        {"arena", "Allocate protobuf messages on per-handler arenas."},
+        {"channels", "Number of channels (TCP connections) the calls are spread over.", "count", "1"},
+        {"channel-selection", "Channel of a new call: round-robin or least-outstanding.", "policy", "round-robin"},
+        {"transport", "How to reach the server: tcp, unix:<path> or inprocess (runs a server in this process).",
+         "transport", "tcp"},
+        {"consumer", "Hand the received values to a consumer thread through lock-free rings, as an application would."},
+        {"deadline", "Deadline of every call in milliseconds (0 - none).", "msec", "0"},
+        {"method-deadline", "Deadline of one method, e.g. stream_int=2000. May be repeated.", "spec"},
+        {"no-resume", "Do not resume StreamString/StreamInt calls broken by the connection."},
+        {"resume-attempts", "Resumes of one stream in a row before giving up.", "count", "5"},
+        {"log-level", "Minimal level of log records: trace, debug, info, warn, error or off.", "level", "info"},
+    });
+    parser.process(app);
+
+    if (!frankenstein::logger::set_level(parser.value("log-level").toStdString().c_str()))
+        LOG_WARN("unknown log level, keeping 'info'");
+
+    frankenstein::client_options options;
+    options.arena.enabled = parser.isSet("arena");
+    options.channel.channels = parser.value("channels").toUInt();
+    if (!frankenstein::from_string(parser.value("channel-selection").toStdString(), options.channel.selection))
+        LOG_WARN("unknown channel selection, keeping 'round-robin'");
+    options.deadlines.set_all(std::chrono::milliseconds(parser.value("deadline").toUInt()));
+    for (const auto& spec : parser.values("method-deadline")) {
+        if (!options.deadlines.set(spec.toStdString()))
+            LOG_WARN("malformed --method-deadline '%s', ignored", spec.toStdString().c_str());
+    }
+    options.resume.enabled = !parser.isSet("no-resume");
+    options.resume.attempts = parser.value("resume-attempts").toUInt();
+    if (parser.isSet("event-dispatch"))
+        options.mode = frankenstein::client_mode::EVENT;
 
-    auto grpc_client = frankenstein::client(50051);
+    if (!frankenstein::from_string(parser.value("transport").toStdString(), options.transport))
+        LOG_WARN("unknown transport, keeping 'tcp'");
+
+    // in-process: the server runs on the Qt thread of the client, its calls never leave the process
+    std::optional<frankenstein::server> embedded_server;
+    std::optional<frankenstein::client> client_instance;
+    if (options.transport.kind == frankenstein::transport_kind::IN_PROCESS) {
+        frankenstein::server_options server_options;
+        server_options.transport = options.transport;
+        embedded_server.emplace(50051, server_options);
+        embedded_server->init();
+        auto& server = *embedded_server;
+        client_instance.emplace(
+            [&server](const ::grpc::ChannelArguments& args) { return server.in_process_channel(args); }, options);
+    } else {
+        client_instance.emplace(50051, options);
+    }
+    auto& grpc_client = *client_instance;
+
+    // the consumer drains both rings in batches, every value is read in place
+    using string_values = frankenstein::reply_subscription<proto::StringReply>;
+    using int_values = frankenstein::reply_subscription<proto::IntReply>;
+    std::atomic<bool> consuming{parser.isSet("consumer")};
+    std::thread consumer;
+    if (consuming) {
+        auto strings = std::make_shared<string_values>(4096);
+        auto ints = std::make_shared<int_values>(4096);
+        grpc_client.set_reply_sink(strings);
+        grpc_client.set_reply_sink(ints);
+
+        consumer = std::thread([strings, ints, &consuming]() {
+            uint64_t values = 0;
+            int64_t checksum = 0;
+            auto add_string = [&checksum](const string_values::value_type& value) {
+                checksum += static_cast<int64_t>(value.reply.msg().size());
+            };
+            auto add_int = [&checksum](const int_values::value_type& value) { checksum += value.reply.msg(); };
+
+            while (consuming.load(std::memory_order_relaxed)) {
+                auto taken = strings->drain(add_string, 256);
+                taken += ints->drain(add_int, 256);
+                values += taken;
+                if (!taken)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            LOG_INFO("consumer: %lu values (checksum %ld), dropped %lu",
+                     values,
+                     checksum,
+                     strings->dropped() + ints->dropped());
+        });
+    }
 
     // grpc_client.send_ping(500);
     // grpc_client.send_ping(1500);
@@ -24,6 +118,15 @@ int main(int argc, char** argv)
     grpc_client.create_stream_int("user1", 540);
     // grpc_client.create_stream_int("user1", 8000);
 
+    // grpc_client.create_stream_string_batch("user1", 500);
+    // grpc_client.create_stream_int_batch("user1", 500);
+
+    // one BiStreamString call for both names, the second request switches it over
+    // grpc_client.subscribe_string("user1", 500);
+    // grpc_client.subscribe_string("user2", 540);
+    // grpc_client.subscribe_int("user1", 500);
+    // grpc_client.unsubscribe(8000);
+
     // grpc_client.create_stream_string("user2", 500);
     // grpc_client.create_stream_string("user2", 501);
     // grpc_client.create_stream_string("user2", 8000);
@@ -34,5 +137,9 @@ int main(int argc, char** argv)
 
     app.exec();
 
+    consuming = false;
+    if (consumer.joinable())
+        consumer.join();
+
     return 0;
 }
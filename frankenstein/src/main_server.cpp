@@ -1,18 +1,131 @@
 #include <csignal>
 
+#ifdef __linux__
+#include <signal.h>
+#endif
+
+#include <QtCore/QCommandLineParser>
+
 #include <frankenstein/commons.hpp>
 #include <frankenstein/server.hpp>
 
 int main(int argc, char** argv)
 {
+    safe_application app(argc, argv);
+    safe_application::setApplicationName("Frankenstein server");
+
+    signal_watcher quit_on_signal;
     std::signal(SIGTERM, signal_handler);
     std::signal(SIGINT, signal_handler);
 
-    safe_application app(argc, argv);
-    safe_application::setApplicationName("Frankenstein server");
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOptions({
+        {"engine", "Server engine: queue (completion queue handlers) or callback (callback API reactors).", "engine",
+         "queue"},
+        {"transport", "Where to listen: tcp (port 50051) or unix:<path>.", "transport", "tcp"},
+        {"no-reuse-port", "Bind the TCP port without SO_REUSEPORT, a second server on the port fails to start."},
+        {"replace", "Hot restart: once listening, send SIGTERM to the server process 'pid' on the same port.", "pid"},
+        {"drain-timeout", "Time the calls in flight get to finish on shutdown, milliseconds.", "msec", "5000"},
+        {"mode", "Queue dispatch mode of the queue engine: polling, event or threaded.", "mode", "polling"},
+        {"queues", "Number of completion queues in threaded mode (0 - one per hardware thread).", "count", "0"},
+        {"pin-threads", "Pin every poller thread to its own cpu."},
+        {"arena", "Allocate protobuf messages on per-handler arenas."},
+        {"log-level", "Minimal level of log records: trace, debug, info, warn, error or off.", "level", "info"},
+        {"stream-interval", "Delay between two messages of one stream in microseconds.", "usec", "10000"},
+        {"stream-rate", "Messages per second of one stream, overrides --stream-interval.", "rate"},
+        {"stream-length", "Values sent by one stream before it is finished.", "count", "5"},
+        {"batch-size", "Max values per message of batched streams.", "count", "64"},
+        {"batch-delay", "Max time a value of a batched stream waits for its batch, microseconds.", "usec", "5000"},
+        {"send-queue", "Overflow policy of bidirectional stream queues: block, drop-oldest or conflate.", "policy",
+         "block"},
+        {"send-queue-size", "Values a bidirectional stream buffers for a slow client.", "count", "64"},
+        {"reply-cache", "Encoded replies kept per queue for repeated payloads (0 - off).", "count", "256"},
+        {"streams-per-name", "Concurrent streams of one name, more are rejected (0 - unlimited).", "count", "0"},
+        {"streams-per-peer", "Concurrent streams of one client host (0 - unlimited).", "count", "0"},
+        {"call-rate", "New calls per second of one client host (0 - unlimited).", "rate", "0"},
+        {"message-rate", "Messages per second of one stream on top of --stream-interval (0 - unlimited).", "rate",
+         "0"},
+        {"replay-size", "StreamString updates kept per topic for resumed calls (0 - off).", "count", "64"},
+        {"replay-linger", "How long a topic whose last subscriber broke off keeps publishing, milliseconds.", "msec",
+         "5000"},
+        {"compression", "Compression of the text streams: none, gzip or deflate.", "algorithm", "none"},
+        {"compression-threshold", "Replies below this size in bytes are sent uncompressed.", "bytes", "1024"},
+        {"compression-sample",
+         "Deflate every N-th compressed reply once more to estimate the savings, costs poller cpu (0 - off).",
+         "count",
+         "0"},
+        {"compress-method", "Compression of one method, e.g. stream_int_batch=gzip:4096. May be repeated.", "spec"},
+        {"metrics-interval", "Period of the metrics dump to the log in milliseconds (0 - off).", "msec", "0"},
+    });
+    parser.process(app);
+
+    if (!frankenstein::logger::set_level(parser.value("log-level").toStdString().c_str()))
+        LOG_WARN("unknown log level, keeping 'info'");
 
-    auto grpc_server = frankenstein::server(50051);
+    frankenstein::server_options options;
+    if (!frankenstein::from_string(parser.value("engine").toStdString(), options.engine))
+        LOG_WARN("unknown server engine, keeping 'queue'");
+    if (!frankenstein::from_string(parser.value("transport").toStdString(), options.transport) ||
+        options.transport.kind == frankenstein::transport_kind::IN_PROCESS) {
+        LOG_WARN("unknown transport or one a standalone server cannot use, keeping 'tcp'");
+        options.transport = {};
+    }
+    options.reuse_port = !parser.isSet("no-reuse-port");
+    options.drain_timeout = std::chrono::milliseconds(parser.value("drain-timeout").toUInt());
+    options.arena.enabled = parser.isSet("arena");
+    // a typo would benchmark the wrong dispatch silently
+    if (!frankenstein::from_string(parser.value("mode").toStdString(), options.mode)) {
+        LOG_ERROR("unknown mode '%s', expected polling, event or threaded", parser.value("mode").toStdString().c_str());
+        return 1;
+    }
+    options.queues = parser.value("queues").toUInt();
+    options.pin_threads = parser.isSet("pin-threads");
+    options.stream_interval = std::chrono::microseconds(parser.value("stream-interval").toUInt());
+    options.stream_length = parser.value("stream-length").toUInt();
+    options.stream_batch_size = parser.value("batch-size").toUInt();
+    options.stream_batch_delay = std::chrono::microseconds(parser.value("batch-delay").toUInt());
+    options.reply_cache_size = parser.value("reply-cache").toUInt();
+    options.admission.streams_per_name = parser.value("streams-per-name").toUInt();
+    options.admission.streams_per_peer = parser.value("streams-per-peer").toUInt();
+    options.admission.calls_per_second = parser.value("call-rate").toDouble();
+    options.admission.messages_per_second = parser.value("message-rate").toDouble();
+    options.replay_size = parser.value("replay-size").toUInt();
+    options.replay_linger = std::chrono::milliseconds(parser.value("replay-linger").toUInt());
+    grpc_compression_algorithm compression = GRPC_COMPRESS_NONE;
+    if (!frankenstein::from_string(parser.value("compression").toStdString(), compression))
+        LOG_WARN("unknown compression algorithm, keeping 'none'");
+    options.compression.set_text_methods(compression, parser.value("compression-threshold").toUInt());
+    options.compression.sample_every = parser.value("compression-sample").toUInt();
+    for (const auto& spec : parser.values("compress-method")) {
+        if (!options.compression.set(spec.toStdString()))
+            LOG_WARN("malformed --compress-method '%s', ignored", spec.toStdString().c_str());
+    }
+    options.metrics_interval = std::chrono::milliseconds(parser.value("metrics-interval").toUInt());
+    options.send_queue.capacity = parser.value("send-queue-size").toUInt();
+    if (!frankenstein::from_string(parser.value("send-queue").toStdString(), options.send_queue.policy))
+        LOG_WARN("unknown send queue policy, keeping 'block'");
+    if (parser.isSet("stream-rate")) {
+        const auto rate = parser.value("stream-rate").toDouble();
+        options.stream_interval = std::chrono::microseconds(rate > 0 ? static_cast<int64_t>(1e6 / rate) : 0);
+    }
+
+    auto grpc_server = frankenstein::server(50051, options);
     grpc_server.init();
+    if (!grpc_server.serving())
+        return 1;
+
+    // the old server stops accepting only now, the port never refuses a connection in between
+    if (parser.isSet("replace")) {
+        const auto pid = parser.value("replace").toInt();
+#ifdef __linux__
+        LOG_INFO("replacing server process %d", pid);
+        if (pid <= 0 || kill(pid, SIGTERM) != 0)
+            LOG_ERROR("failed to signal server process %d, it keeps serving", pid);
+#else
+        LOG_WARN("--replace is not supported on this platform, server process %d keeps serving", pid);
+#endif
+    }
 
     app.exec();
 
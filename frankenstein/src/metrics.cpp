@@ -0,0 +1,177 @@
+#include <frankenstein/metrics.hpp>
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+namespace frankenstein {
+
+namespace chr = std::chrono;
+
+namespace {
+
+std::mutex slabs_mutex;
+std::vector<std::unique_ptr<metrics_slab>> slabs;
+
+double per_second(uint64_t current, uint64_t previous, double seconds)
+{
+    return seconds > 0 ? static_cast<double>(current - previous) / seconds : 0.0;
+}
+
+double usec(uint64_t nsec)
+{
+    return static_cast<double>(nsec) / 1000.0;
+}
+
+// names is null-terminated, a handler may have fewer names than the state index
+const char* state_name(const char* const* names, std::size_t state)
+{
+    if (!names)
+        return nullptr;
+
+    for (std::size_t i = 0; names[i]; ++i) {
+        if (i == state)
+            return names[i];
+    }
+    return nullptr;
+}
+
+} // namespace
+
+const char* to_string(metric_method method)
+{
+    switch (method) {
+        case metric_method::PING:
+            return "ping";
+        case metric_method::STATS:
+            return "stats";
+        case metric_method::STREAM_STRING:
+            return "stream_string";
+        case metric_method::STREAM_INT:
+            return "stream_int";
+        case metric_method::STREAM_STRING_BATCH:
+            return "stream_string_batch";
+        case metric_method::STREAM_INT_BATCH:
+            return "stream_int_batch";
+        case metric_method::BI_STREAM_STRING:
+            return "bi_stream_string";
+        case metric_method::BI_STREAM_INT:
+            return "bi_stream_int";
+        default:
+            return "";
+    }
+}
+
+const char* to_string(metric_side side)
+{
+    switch (side) {
+        case metric_side::SERVER:
+            return "server";
+        case metric_side::CLIENT:
+            return "client";
+        default:
+            return "";
+    }
+}
+
+metrics_slab* metrics::create_slab()
+{
+    std::lock_guard<std::mutex> lock(slabs_mutex);
+    slabs.push_back(std::make_unique<metrics_slab>());
+    return slabs.back().get();
+}
+
+metrics_snapshot metrics::snapshot()
+{
+    metrics_snapshot result;
+    result.time = chr::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(slabs_mutex);
+    for (const auto& slab : slabs) {
+        for (std::size_t side = 0; side < result.sides.size(); ++side) {
+            const auto& from_side = slab->sides[side];
+            auto& to_side = result.sides[side];
+
+            for (std::size_t m = 0; m < to_side.methods.size(); ++m) {
+                const auto& from = from_side.methods[m];
+                auto& to = to_side.methods[m];
+
+                to.started += from.started.get();
+                to.finished += from.finished.get();
+                to.failed += from.failed.get();
+                to.sent += from.sent.get();
+                to.received += from.received.get();
+                to.latency.merge(from.latency);
+                for (std::size_t s = 0; s < metrics_slab::max_states; ++s)
+                    to.states[s].merge(from.states[s]);
+                if (!to.state_names)
+                    to.state_names = from.state_names.load(std::memory_order_relaxed);
+            }
+            to_side.queue_events += from_side.queue_events.get();
+        }
+    }
+
+    return result;
+}
+
+std::vector<std::string> metrics_snapshot::to_lines(metric_side side, const metrics_snapshot* previous) const
+{
+    std::vector<std::string> lines;
+    char buffer[256];
+
+    const double seconds = previous ? chr::duration<double>(time - previous->time).count() : 0.0;
+    const auto& current = (*this)[side];
+    const auto* before = previous ? &(*previous)[side] : nullptr;
+
+    std::snprintf(buffer,
+                  sizeof(buffer),
+                  "%s queue events %lu (%.1f/s)",
+                  to_string(side),
+                  current.queue_events,
+                  per_second(current.queue_events, before ? before->queue_events : 0, seconds));
+    lines.emplace_back(buffer);
+
+    for (std::size_t m = 0; m < current.methods.size(); ++m) {
+        const auto& method = current.methods[m];
+        if (!method.started)
+            continue;
+
+        const auto* last = before ? &before->methods[m] : nullptr;
+        std::snprintf(buffer,
+                      sizeof(buffer),
+                      "%s: active %lu, calls %lu (%.1f/s), failed %lu, sent %lu (%.1f/s), received %lu (%.1f/s), "
+                      "latency p50/p99 %.1f/%.1f us",
+                      to_string(static_cast<metric_method>(m)),
+                      method.started - method.finished,
+                      method.finished,
+                      per_second(method.finished, last ? last->finished : 0, seconds),
+                      method.failed,
+                      method.sent,
+                      per_second(method.sent, last ? last->sent : 0, seconds),
+                      method.received,
+                      per_second(method.received, last ? last->received : 0, seconds),
+                      usec(method.latency.percentile(50)),
+                      usec(method.latency.percentile(99)));
+        lines.emplace_back(buffer);
+
+        std::string states = std::string(to_string(static_cast<metric_method>(m))) + ": states p50/p99 us:";
+        for (std::size_t s = 0; s < metrics_slab::max_states; ++s) {
+            if (!method.states[s].count())
+                continue;
+
+            const auto p50 = usec(method.states[s].percentile(50));
+            const auto p99 = usec(method.states[s].percentile(99));
+            const char* name = state_name(method.state_names, s);
+            if (name)
+                std::snprintf(buffer, sizeof(buffer), " %s %.1f/%.1f", name, p50, p99);
+            else
+                std::snprintf(buffer, sizeof(buffer), " #%zu %.1f/%.1f", s, p50, p99);
+            states += buffer;
+        }
+        lines.push_back(std::move(states));
+    }
+
+    return lines;
+}
+
+} // namespace frankenstein
@@ -0,0 +1,19 @@
+#include <frankenstein/send_queue.hpp>
+
+namespace frankenstein {
+
+bool from_string(const std::string& name, overflow_policy& policy)
+{
+    if (name == "block")
+        policy = overflow_policy::BLOCK;
+    else if (name == "drop-oldest")
+        policy = overflow_policy::DROP_OLDEST;
+    else if (name == "conflate")
+        policy = overflow_policy::CONFLATE;
+    else
+        return false;
+
+    return true;
+}
+
+} // namespace frankenstein
@@ -1,66 +1,369 @@
 #include <frankenstein/server.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <thread>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <frankenstein/callback_service.hpp>
+
 namespace frankenstein {
 
 namespace chr = std::chrono;
 using namespace std::chrono_literals;
 
-server::server(uint16_t port) : _port(port), _timer(this)
+const char* to_string(server_engine engine)
+{
+    switch (engine) {
+        case server_engine::QUEUE:
+            return "queue";
+        case server_engine::CALLBACK:
+            return "callback";
+        default:
+            return "";
+    }
+}
+
+bool from_string(const std::string& name, server_mode& mode)
+{
+    if (name == "polling")
+        mode = server_mode::POLLING;
+    else if (name == "event")
+        mode = server_mode::EVENT;
+    else if (name == "threaded")
+        mode = server_mode::THREADED;
+    else
+        return false;
+
+    return true;
+}
+
+bool from_string(const std::string& name, server_engine& engine)
+{
+    if (name == "queue")
+        engine = server_engine::QUEUE;
+    else if (name == "callback")
+        engine = server_engine::CALLBACK;
+    else
+        return false;
+
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+std::size_t server_shard::live_handlers() const
 {
-    LOG("server::ctor()");
+    auto live = ping_handlers.live() + stats_handlers.live() + stream_string_handlers.live() +
+                stream_int_handlers.live() + stream_string_batch_handlers.live() + stream_int_batch_handlers.live() +
+                bi_stream_string_handlers.live() + bi_stream_int_handlers.live();
+#ifdef FRANKENSTEIN_COROUTINES
+    live += frames.live();
+#endif
+    return live + topics.live();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+server::server(uint16_t port, server_options options) :
+    _port(port),
+    _options(options),
+    _timer(this),
+    _metrics_timer(this)
+{
+    LOG_INFO("server::ctor()");
 
     connect(&_timer, &QTimer::timeout, this, &server::poll);
+    connect(&_metrics_timer, &QTimer::timeout, this, &server::dump_metrics);
     connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &server::stop);
 }
 
 server::~server()
 {
-    LOG("server::dtor()");
+    LOG_INFO("server::dtor()");
     stop();
 }
 
 void server::init()
 {
-    LOG("server::init()");
+    const auto server_address = transport_address(_options.transport, "0.0.0.0:" + std::to_string(_port));
+    LOG_INFO("server::init(engine=%s, transport=%s, address='%s')",
+             to_string(_options.engine),
+             to_string(_options.transport.kind),
+             server_address.c_str());
+
+    if (_options.engine == server_engine::CALLBACK)
+        init_callback_engine(server_address);
+    else
+        init_queue_engine(server_address);
+
+    if (_options.metrics_interval.count() > 0) {
+        _last_metrics = metrics::snapshot();
+        _metrics_timer.start(static_cast<int>(_options.metrics_interval.count()));
+    }
+}
 
-    const std::string server_address("0.0.0.0:" + std::to_string(_port));
+void server::init_queue_engine(const std::string& server_address)
+{
+    std::size_t queues = 1;
+    if (_options.mode == server_mode::THREADED) {
+        queues = _options.queues ? _options.queues : std::max(1u, std::thread::hardware_concurrency());
+    }
 
     _service = std::make_shared<async_service>();
     ::grpc::ServerBuilder builder;
-    builder.AddListeningPort(server_address, ::grpc::InsecureServerCredentials());
+    if (!server_address.empty())
+        builder.AddListeningPort(server_address, ::grpc::InsecureServerCredentials());
+    builder.AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT, _options.reuse_port ? 1 : 0);
     builder.RegisterService(_service.get());
     builder.SetSyncServerOption(::grpc::ServerBuilder::MAX_POLLERS, 1);
-    _queue = grpc_server_queue_ptr(builder.AddCompletionQueue());
+    _admission = std::make_shared<admission_control>(_options.admission);
+    for (std::size_t i = 0; i < queues; ++i) {
+        auto shard = std::make_shared<server_shard>();
+        shard->index = i;
+        shard->service = _service;
+        shard->queue = grpc_server_queue_ptr(builder.AddCompletionQueue());
+        shard->options = _options;
+        shard->replies.set_capacity(_options.reply_cache_size);
+        shard->admission = _admission;
+        _shards.push_back(std::move(shard));
+    }
     _server = grpc_server_ptr(builder.BuildAndStart());
+    if (!_server) {
+        LOG_ERROR("server::init(): failed to start on '%s'", server_address.c_str());
+        return;
+    }
 
     // handlers
     // NOTE: CompletionQueue segfaults when no handlers
-    new ping_server_handler(_service, _queue);
-    new stream_string_server_handler(_service, _queue);
-    new stream_int_server_handler(_service, _queue);
+    for (const auto& shard : _shards) {
+        shard->ping_handlers.create(shard);
+        shard->stats_handlers.create(shard);
+        shard->stream_string_handlers.create(shard);
+#ifdef FRANKENSTEIN_COROUTINES
+        stream_int_coroutine(shard->frames, shard);
+#else
+        shard->stream_int_handlers.create(shard);
+#endif
+        shard->stream_string_batch_handlers.create(shard);
+        shard->stream_int_batch_handlers.create(shard);
+        shard->bi_stream_string_handlers.create(shard);
+        shard->bi_stream_int_handlers.create(shard);
+    }
 
-    _timer.start();
+    if (_options.mode == server_mode::THREADED) {
+        for (std::size_t i = 0; i < queues; ++i)
+            _threads.emplace_back(&server::run, this, i);
+    } else if (_options.mode == server_mode::EVENT) {
+        _dispatcher = std::make_unique<queue_dispatcher>(_shards.front()->queue, _options.batch_size);
+        connect(_dispatcher.get(), &queue_dispatcher::ready, this, &server::dispatch, Qt::QueuedConnection);
+        _dispatcher->start();
+    } else {
+        _timer.start();
+    }
+}
+
+void server::init_callback_engine(const std::string& server_address)
+{
+    // reactors run on the threads of grpc, the Qt thread only keeps the metrics timer
+    if (_options.compression.enabled())
+        LOG_WARN("server::init(): compression options apply to the queue engine only, callback replies go out raw");
+    _admission = std::make_shared<admission_control>(_options.admission);
+    _callback_service = std::make_unique<callback_service>(_options, _admission);
+    ::grpc::ServerBuilder builder;
+    if (!server_address.empty())
+        builder.AddListeningPort(server_address, ::grpc::InsecureServerCredentials());
+    builder.AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT, _options.reuse_port ? 1 : 0);
+    builder.RegisterService(_callback_service.get());
+    _server = grpc_server_ptr(builder.BuildAndStart());
+    if (!_server)
+        LOG_ERROR("server::init(): failed to start on '%s'", server_address.c_str());
+}
+
+std::shared_ptr<::grpc::Channel> server::in_process_channel(const ::grpc::ChannelArguments& args)
+{
+    return _server ? _server->InProcessChannel(args) : nullptr;
 }
 
 void server::stop()
 {
-    LOG("server::stop()");
+    if (_stopped)
+        return;
+    _stopped = true;
+
+    LOG_INFO("server::stop()");
 
     _timer.stop();
+    _metrics_timer.stop();
+
+    drain();
+
+    for (const auto& shard : _shards)
+        shard->queue->Shutdown();
+
+    if (_callback_service)
+        _callback_service->log_stats();
+
+    for (auto& thread : _threads) {
+        if (thread.joinable())
+            thread.join();
+    }
+
+    // the tags left in the queue are handed to their handlers, so every one of them is released
+    if (_dispatcher) {
+        _dispatcher->stop();
+        dispatch();
+    } else if (_options.engine == server_engine::QUEUE && _options.mode == server_mode::POLLING && !_shards.empty()) {
+        void* tag;
+        bool ok = false;
+        while (_shards.front()->queue->Next(&tag, &ok))
+            static_cast<server_method_handler_stub*>(tag)->proceed(ok);
+    }
 
-    if (_server)
-        _server->Shutdown();
+    for (const auto& shard : _shards) {
+        LOG_INFO("server::stop(): queue %zu pools hits/misses: ping %lu/%lu, stream_string %lu/%lu, stream_int "
+                 "%lu/%lu, stream_string_batch %lu/%lu, stream_int_batch %lu/%lu, bi_stream_string %lu/%lu, "
+                 "bi_stream_int %lu/%lu",
+                 shard->index,
+                 shard->ping_handlers.hits(),
+                 shard->ping_handlers.misses(),
+                 shard->stream_string_handlers.hits(),
+                 shard->stream_string_handlers.misses(),
+                 shard->stream_int_handlers.hits(),
+                 shard->stream_int_handlers.misses(),
+                 shard->stream_string_batch_handlers.hits(),
+                 shard->stream_string_batch_handlers.misses(),
+                 shard->stream_int_batch_handlers.hits(),
+                 shard->stream_int_batch_handlers.misses(),
+                 shard->bi_stream_string_handlers.hits(),
+                 shard->bi_stream_string_handlers.misses(),
+                 shard->bi_stream_int_handlers.hits(),
+                 shard->bi_stream_int_handlers.misses());
+        LOG_INFO("server::stop(): queue %zu send queues: pushed %lu, dropped %lu, conflated %lu, depth %lu, max depth "
+                 "%lu",
+                 shard->index,
+                 shard->send_queues.pushed,
+                 shard->send_queues.dropped,
+                 shard->send_queues.conflated,
+                 shard->send_queues.depth,
+                 shard->send_queues.max_depth);
+        LOG_INFO("server::stop(): queue %zu compression: %lu replies compressed (%lu bytes), %lu below threshold (%lu "
+                 "bytes)",
+                 shard->index,
+                 shard->compression.compressed,
+                 shard->compression.compressed_bytes,
+                 shard->compression.raw,
+                 shard->compression.raw_bytes);
+        if (shard->compression.sampled) {
+            LOG_INFO("server::stop(): queue %zu compression estimate: ~%.0f bytes saved, ~%.3f cpu s from %lu samples",
+                     shard->index,
+                     shard->compression.saved_bytes(),
+                     shard->compression.cpu_seconds(),
+                     shard->compression.sampled);
+        }
+        LOG_INFO("server::stop(): queue %zu topics: %zu open, updates published %lu, subscribers resumed %lu (updates "
+                 "replayed %lu, missed %lu, foreign resume points %lu)",
+                 shard->index,
+                 shard->topics.size(),
+                 shard->topics.published,
+                 shard->topics.replay.resumed,
+                 shard->topics.replay.replayed,
+                 shard->topics.replay.missed,
+                 shard->topics.replay.foreign);
+        LOG_INFO("server::stop(): queue %zu reply cache: %zu entries, hits %lu, misses %lu, evicted %lu",
+                 shard->index,
+                 shard->replies.size(),
+                 shard->replies.stats.hits,
+                 shard->replies.stats.misses,
+                 shard->replies.stats.evicted);
+#ifdef FRANKENSTEIN_COROUTINES
+        LOG_INFO("server::stop(): queue %zu coroutine frames hits/misses: %lu/%lu",
+                 shard->index,
+                 shard->frames.hits(),
+                 shard->frames.misses());
+#endif
+    }
 
-    if (_queue)
-        _queue->Shutdown();
+    if (_admission && _admission->enabled()) {
+        const auto admission = _admission->stats();
+        LOG_INFO("server::stop(): admission: %lu calls admitted, rejected over the call rate %lu, over the name limit "
+                 "%lu, over the peer limit %lu",
+                 admission.admitted,
+                 admission.rejected_rate,
+                 admission.rejected_name,
+                 admission.rejected_peer);
+    }
+
+    dump_metrics();
+}
+
+void server::drain()
+{
+    if (!_server)
+        return;
+
+    const auto started = chr::steady_clock::now();
+    LOG_INFO("server::drain(): stop accepting, %ld ms for the calls in flight",
+             static_cast<long>(_options.drain_timeout.count()));
+
+    // Shutdown() closes the listener right away and blocks until the calls are done or cancelled at the deadline. The
+    // queues stay open meanwhile and in POLLING and EVENT modes this thread keeps serving them.
+    std::atomic<bool> shut_down{false};
+    std::thread shutdown([this, &shut_down]() {
+        _server->Shutdown(chr::system_clock::now() + _options.drain_timeout);
+        shut_down.store(true);
+    });
+    while (!shut_down.load())
+        drive();
+    shutdown.join();
+
+    // nobody is left to resume, topics lingering for broken subscribers go too
+    for (const auto& shard : _shards)
+        shard->stopping.store(true);
+
+    // a cancelled stream learns it only from its next write, at most one pacing interval away. The queues must not be
+    // shut down before: the write would be started on a dead queue.
+    const auto release_deadline =
+        chr::steady_clock::now() + std::max(_options.stream_interval, _options.stream_batch_delay) + 1s;
+    auto live_handlers = [this]() {
+        std::size_t live = 0;
+        for (const auto& shard : _shards)
+            live += shard->live_handlers();
+        return live;
+    };
+    while (live_handlers() > 0 && chr::steady_clock::now() < release_deadline)
+        drive();
+
+    const auto msec = chr::duration_cast<chr::milliseconds>(chr::steady_clock::now() - started).count();
+    if (const auto left = live_handlers())
+        LOG_WARN("server::drain(): %zu handlers still alive after %ld ms", left, static_cast<long>(msec));
+    else
+        LOG_INFO("server::drain(): done in %ld ms", static_cast<long>(msec));
+}
+
+void server::drive()
+{
+    if (_options.engine == server_engine::QUEUE && _options.mode == server_mode::POLLING && !_shards.empty()) {
+        poll();
+        return;
+    }
+
+    if (_dispatcher)
+        dispatch();
+
+    // THREADED mode and the callback engine are served by their own threads
+    if (_events.empty())
+        std::this_thread::sleep_for(1ms);
 }
 
 void server::poll()
 {
-    // LOG("server::poll()");
+    // LOG_TRACE("server::poll()");
 
     void* tag;
     bool ok = false;
@@ -69,153 +372,644 @@ void server::poll()
     const chr::milliseconds wait_msec{1}; // NOTE: increased for testing
     const auto deadline = chr::system_clock::now() + wait_msec;
 
-    const auto status = _queue->AsyncNext(&tag, &ok, deadline);
+    const auto status = _shards.front()->queue->AsyncNext(&tag, &ok, deadline);
     if (status == ::grpc::CompletionQueue::TIMEOUT || status == ::grpc::CompletionQueue::SHUTDOWN)
         return;
 
+    metrics::local()[metric_side::SERVER].queue_events.add();
     static_cast<server_method_handler_stub*>(tag)->proceed(ok);
 }
 
+void server::dispatch()
+{
+    _dispatcher->take(_events);
+    metrics::local()[metric_side::SERVER].queue_events.add(_events.size());
+
+    for (const auto& event : _events)
+        static_cast<server_method_handler_stub*>(event.tag)->proceed(event.ok);
+}
+
+void server::run(std::size_t index)
+{
+    LOG_INFO("server::run(queue=%zu)", index);
+
+    if (_options.pin_threads) {
+#ifdef __linux__
+        const auto cpus = std::max(1u, std::thread::hardware_concurrency());
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(index % cpus, &cpu_set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0)
+            LOG_WARN("server::run(): failed to pin thread to cpu %zu", index % cpus);
+#else
+        LOG_WARN("server::run(): thread pinning is not supported on this platform");
+#endif
+    }
+
+    void* tag;
+    bool ok = false;
+
+    auto& queue_events = metrics::local()[metric_side::SERVER].queue_events;
+    while (_shards[index]->queue->Next(&tag, &ok)) {
+        queue_events.add();
+        static_cast<server_method_handler_stub*>(tag)->proceed(ok);
+    }
+
+    LOG_INFO("server::run(queue=%zu): queue is drained", index);
+}
+
+void server::dump_metrics()
+{
+    const auto current = metrics::snapshot();
+    for (const auto& line : current.to_lines(metric_side::SERVER, &_last_metrics))
+        LOG_INFO("metrics: %s", line.c_str());
+    _last_metrics = current;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 
-ping_server_handler::ping_server_handler(async_service_ptr service, grpc_server_queue_ptr queue) :
-    server_method_handler_oto<async_service_ptr, proto::EmptyRequest, proto::StringReply>(service, queue)
+ping_server_handler::ping_server_handler(server_shard_ptr shard) :
+    _shard(shard),
+    _queue(shard->queue),
+    _context(),
+    _responder(&_context),
+    _service(shard->service),
+    _metrics(metric_side::SERVER, metric_method::PING, state_names)
 {
-    LOG("ping_server_handler::ctor()");
+    LOG_TRACE("ping_server_handler::ctor()");
     _state = handler_state::PROCESS;
     _service->RequestPing(&_context, &_request, &_responder, _queue.get(), _queue.get(), this);
 }
 
 bool ping_server_handler::proceed(bool ok)
 {
-    LOG("ping_server_handler::proceed()");
+    LOG_TRACE("ping_server_handler::proceed()");
+
+    _metrics.state_done(_state);
 
     if (!ok) {
-        LOG("ping_server_handler::proceed(): ok=false");
+        LOG_DEBUG("ping_server_handler::proceed(): ok=false");
+        if (_state == handler_state::FINISH)
+            _metrics.fail();
+        release();
         return false;
     }
 
     switch (_state) {
         case handler_state::PROCESS: {
-            LOG("ping_server_handler::proceed(): status=process");
-            new ping_server_handler(_service, _queue);
-            _reply.set_msg("pong");
+            LOG_TRACE("ping_server_handler::proceed(): status=process");
+            _metrics.start();
+            _shard->ping_handlers.create(_shard);
+
+            const auto admitted = _shard->admission->admit_call(_context);
+            if (!admitted.ok()) {
+                _metrics.fail();
+                _rejected = true;
+                _state = handler_state::FINISH;
+                _responder.FinishWithError(admitted, this);
+                break;
+            }
+
+            // the empty request is not decoded and the reply is encoded only by the first call
+            const auto reply = _shard->replies.get<proto::StringReply>(
+                "ping", 0, [](proto::StringReply& reply) { reply.set_msg("pong"); });
             _state = handler_state::FINISH;
-            _responder.Finish(_reply, grpc_status::OK, this);
+            _responder.Finish(reply, grpc_status::OK, this);
             break;
         }
         default:
-            LOG("ping_server_handler::proceed(): status=finish");
+            LOG_TRACE("ping_server_handler::proceed(): status=finish");
             GPR_ASSERT(_state == handler_state::FINISH);
-            delete this;
-            break;
+            if (!_rejected)
+                _metrics.sent();
+            release();
+            return false;
     }
 
     return true;
 }
 
+void ping_server_handler::release()
+{
+    // keep shard (and its pool) alive while this handler is destroyed
+    const auto shard = _shard;
+    shard->ping_handlers.destroy(this);
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 
-stream_string_server_handler::stream_string_server_handler(async_service_ptr service, grpc_server_queue_ptr queue) :
-    server_method_handler_otm<async_service_ptr, proto::NameRequest, proto::StringReply>(service, queue)
+void fill_stats_reply(server_engine engine, proto::StatsReply& reply)
 {
-    LOG("stream_string_server_handler::ctor()");
-    proceed(true);
+    const auto snapshot = metrics::snapshot();
+    const auto& served = snapshot[metric_side::SERVER];
+    reply.set_queue_events(served.queue_events);
+    for (std::size_t m = 0; m < served.methods.size(); ++m) {
+        const auto& from = served.methods[m];
+        if (!from.started)
+            continue;
+
+        auto* to = reply.add_methods();
+        to->set_name(to_string(static_cast<metric_method>(m)));
+        to->set_active(from.started - from.finished);
+        to->set_calls(from.finished);
+        to->set_failed(from.failed);
+        to->set_sent(from.sent);
+        to->set_received(from.received);
+        to->set_latency_p50_us(from.latency.percentile(50) / 1000);
+        to->set_latency_p99_us(from.latency.percentile(99) / 1000);
+    }
+    for (const auto& line : snapshot.to_lines(metric_side::SERVER))
+        reply.mutable_text()->append(line).append("\n");
+    reply.set_engine(to_string(engine));
 }
 
-stream_string_server_handler::~stream_string_server_handler()
+// ---------------------------------------------------------------------------------------------------------------------
+
+stats_server_handler::stats_server_handler(server_shard_ptr shard) :
+    server_method_handler_oto<async_service_ptr, proto::EmptyRequest, proto::StatsReply>(shard, metric_method::STATS)
 {
-    LOG("stream_string_server_handler::dtor()");
+    LOG_TRACE("stats_server_handler::ctor()");
+    _state = handler_state::PROCESS;
+    _service->RequestStats(&_context, _request.get(), &_responder, _queue.get(), _queue.get(), this);
 }
 
-void stream_string_server_handler::handle_call_state()
+bool stats_server_handler::proceed(bool ok)
 {
-    LOG("stream_string_server_handler::handle_call_state()");
+    LOG_TRACE("stats_server_handler::proceed()");
 
-    _state = handler_state::WAIT;
-    _service->RequestStreamString(&_context, &_request, &_responder, _queue.get(), _queue.get(), this);
+    _metrics.state_done(_state);
+
+    if (!ok) {
+        LOG_DEBUG("stats_server_handler::proceed(): ok=false");
+        if (_state == handler_state::FINISH)
+            _metrics.fail();
+        release();
+        return false;
+    }
+
+    if (_state == handler_state::FINISH) {
+        _metrics.sent();
+        release();
+        return false;
+    }
+
+    _metrics.start();
+    _shard->stats_handlers.create(_shard);
+
+    fill_stats_reply(_shard->options.engine, *_reply);
+
+    _state = handler_state::FINISH;
+    _responder.Finish(*_reply, grpc_status::OK, this);
+    return true;
+}
+
+void stats_server_handler::release()
+{
+    const auto shard = _shard;
+    shard->stats_handlers.destroy(this);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+topic::topic(server_shard* shard, std::string name) :
+    _shard(shard),
+    _name(std::move(name)),
+    _value(std::max<std::size_t>(1, shard->options.stream_length)),
+    _first_seq(std::max<uint64_t>(
+        1, chr::duration_cast<chr::microseconds>(chr::system_clock::now().time_since_epoch()).count())),
+    _next_seq(_first_seq),
+    _history(shard->options.replay_size),
+    _rate(shard->options.admission.message_limit())
+{
+    LOG_DEBUG("topic::ctor(name=%s)", _name.c_str());
 }
 
-void stream_string_server_handler::handle_wait_state()
+void topic::subscribe(stream_string_server_handler* subscriber, uint64_t resume_after)
 {
-    LOG("stream_string_server_handler::handle_wait_state()");
+    subscriber->topic_index = _subscribers.size();
+    _subscribers.push_back(subscriber);
 
-    new stream_string_server_handler(_service, _queue);
+    if (resume_after)
+        replay(subscriber, resume_after);
 
-    _state = handler_state::WRITE;
-    _responder.Write(_reply, this);
+    if (!_alarm_set)
+        schedule();
+}
 
-    // NOTE: if first reply state invalid
-    /* _state = handler_state::FINISH; */
-    /* _responder.WriteAndFinish(_reply, ::grpc::WriteOptions(), grpc_status::OK, this); */
+void topic::unsubscribe(stream_string_server_handler* subscriber, bool broken)
+{
+    // swap with the last one, the order of subscribers does not matter
+    const auto index = subscriber->topic_index;
+    _subscribers[index] = _subscribers.back();
+    _subscribers[index]->topic_index = index;
+    _subscribers.pop_back();
+
+    if (broken && _history.capacity())
+        _linger_until = chr::system_clock::now() + _shard->options.replay_linger;
 }
 
-void stream_string_server_handler::handle_write_state()
+void topic::replay(stream_string_server_handler* subscriber, uint64_t resume_after)
 {
-    LOG("stream_string_server_handler::handle_write_state()");
+    auto& stats = _shard->topics.replay;
+    ++stats.resumed;
 
-    if (amount > 0) {
-        // std::this_thread::sleep_for(1000ms);
-        std::this_thread::sleep_for(10ms);
-        _reply.set_msg(std::to_string(amount--));
-        LOG("stream_string_server_handler::handle_write_state(): write '" + _reply.msg() + "'");
-        _responder.Write(_reply, this);
-    } else {
-        _state = handler_state::FINISH;
-        _responder.WriteAndFinish(_reply, ::grpc::WriteOptions(), grpc_status::OK, this);
+    if (resume_after < _first_seq || resume_after >= _next_seq) {
+        LOG_DEBUG("topic::replay(name=%s): seq %lu is not from this topic, start live", _name.c_str(), resume_after);
+        ++stats.foreign;
+        return;
+    }
+
+    // the oldest update the subscriber has not seen is gone already
+    const auto oldest = _history.size() ? _history.first_seq() : _next_seq;
+    if (resume_after + 1 < oldest) {
+        LOG_DEBUG("topic::replay(name=%s): %lu updates after seq %lu are lost",
+                  _name.c_str(),
+                  oldest - resume_after - 1,
+                  resume_after);
+        stats.missed += oldest - resume_after - 1;
     }
+
+    // queued like live updates: a conflating subscriber gets only the newest one
+    stats.replayed += _history.for_each_after(resume_after, [subscriber](uint64_t, const replay_entry& entry) {
+        subscriber->publish(entry.update, entry.last);
+    });
 }
 
-// ---------------------------------------------------------------------------------------------------------------------
+bool topic::proceed(bool ok)
+{
+    LOG_TRACE("topic::proceed(name=%s): %zu subscribers", _name.c_str(), _subscribers.size());
+
+    _alarm_set = false;
+
+    if (!ok) {
+        // the queue is shutting down, the subscribers are cancelled and the shard takes the topic with it
+        LOG_DEBUG("topic::proceed(name=%s): alarm cancelled", _name.c_str());
+        return false;
+    }
 
-stream_int_server_handler::stream_int_server_handler(async_service_ptr service, grpc_server_queue_ptr queue) :
-    server_method_handler_otm<async_service_ptr, proto::NameRequest, proto::IntReply>(service, queue)
+    if (_subscribers.empty() &&
+        (_shard->stopping.load(std::memory_order_relaxed) || chr::system_clock::now() >= _linger_until)) {
+        release();
+        return false;
+    }
+
+    // every topic of the queue counts down the same values, so they share the encoded values too and only the seq and
+    // the send time are encoded per update
+    const auto value = std::to_string(_value);
+    const auto cached = _shard->replies.get<proto::StringReply>(
+        value, 0, [&value](proto::StringReply& reply) { reply.set_msg(value); });
+    const auto seq = _next_seq++;
+    const auto update = append_uint64_fields(cached,
+                                             {proto::StringReply::kSeqFieldNumber, seq},
+                                             {proto::StringReply::kSentAtNsFieldNumber, wall_clock_ns()},
+                                             _slices);
+
+    const bool last = _value == 1;
+    _value = last ? std::max<std::size_t>(1, _shard->options.stream_length) : _value - 1;
+    _history.push(seq, {update, last});
+
+    // subscribers only queue the update here, none of them leaves the topic during the loop
+    for (auto* subscriber : _subscribers)
+        subscriber->publish(update, last);
+    _shard->topics.published += _subscribers.size();
+
+    schedule();
+    return true;
+}
+
+void topic::release()
 {
-    LOG("stream_int_server_handler::ctor()");
-    proceed(true);
+    LOG_DEBUG("topic::release(name=%s)", _name.c_str());
+    _shard->topics.erase(_name);
 }
 
-stream_int_server_handler::~stream_int_server_handler()
+void topic::schedule()
 {
-    LOG("stream_int_server_handler::dtor()");
+    const auto now = chr::system_clock::now();
+    const auto interval = _shard->options.stream_interval;
+    if (_next_update.time_since_epoch().count() == 0)
+        _next_update = now;
+    _next_update = _rate.reserve(std::max(now, _next_update + interval));
+
+    // a zero interval still goes through the queue, so other calls get their turn between updates
+    _alarm_set = true;
+    _alarm.Set(_shard->queue.get(), _next_update, this);
 }
 
-void stream_int_server_handler::handle_call_state()
+topic& topic_registry::find_or_create(server_shard* shard, const std::string& name)
+{
+    auto& entry = _topics[name];
+    if (!entry) {
+        entry = std::make_unique<topic>(shard, name);
+        _live.fetch_add(1, std::memory_order_relaxed);
+    }
+    return *entry;
+}
+
+void topic_registry::erase(const std::string& name)
+{
+    if (_topics.erase(name))
+        _live.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+stream_string_server_handler::stream_string_server_handler(server_shard_ptr shard) :
+    _shard(shard),
+    _queue(shard->queue),
+    _context(),
+    _responder(&_context),
+    _service(shard->service),
+    _metrics(metric_side::SERVER, metric_method::STREAM_STRING, state_names),
+    _compression(shard->options.compression, metric_method::STREAM_STRING, shard->compression),
+    _send_queue(shard->options.send_queue, shard->send_queues),
+    _done(this, &stream_string_server_handler::call_done)
 {
-    LOG("stream_int_server_handler::handle_call_state()");
+    LOG_TRACE("stream_string_server_handler::ctor()");
 
     _state = handler_state::WAIT;
-    _service->RequestStreamInt(&_context, &_request, &_responder, _queue.get(), _queue.get(), this);
+    _done.watch(_context);
+    _service->RequestStreamString(&_context, &_request, &_responder, _queue.get(), _queue.get(), this);
+}
+
+stream_string_server_handler::~stream_string_server_handler()
+{
+    LOG_TRACE("stream_string_server_handler::dtor()");
 }
 
-void stream_int_server_handler::handle_wait_state()
+bool stream_string_server_handler::proceed(bool ok)
 {
-    LOG("stream_int_server_handler::handle_wait_state()");
+    LOG_TRACE("stream_string_server_handler::proceed()");
+
+    _metrics.state_done(_state);
 
-    new stream_int_server_handler(_service, _queue);
+    if (_state == handler_state::FINISH) {
+        LOG_TRACE("stream_string_server_handler::proceed(): call finished");
+        release_after_done();
+        return false;
+    }
+
+    if (!ok && _state == handler_state::WAIT) {
+        // no call, no done tag either
+        LOG_DEBUG("stream_string_server_handler::proceed(): server has been shut down before receiving a matching "
+                  "request");
+        release();
+        return false;
+    }
+
+    if (!ok || (_state == handler_state::STREAM && _done.cancelled())) {
+        LOG_DEBUG("stream_string_server_handler::proceed(): abort: call is cancelled or connection is dropped");
+        _metrics.fail();
+        // leave the topic now rather than with the done tag, a dead subscriber would keep queueing its updates
+        if (_topic) {
+            _topic->unsubscribe(this, true);
+            _topic = nullptr;
+        }
+        release_after_done();
+        return false;
+    }
 
-    _state = handler_state::WRITE;
-    _responder.Write(_reply, this);
+    if (_state == handler_state::WAIT) {
+        _metrics.start();
+        _shard->stream_string_handlers.create(_shard);
 
-    // NOTE: if first reply state invalid
-    /* _state = handler_state::FINISH; */
-    /* _responder.WriteAndFinish(_reply, ::grpc::WriteOptions(), grpc_status::OK, this); */
+        proto::NameRequest request;
+        if (!::grpc::SerializationTraits<proto::NameRequest>::Deserialize(&_request, &request).ok()) {
+            LOG_WARN("stream_string_server_handler::proceed(): malformed request");
+            _metrics.fail();
+            _state = handler_state::FINISH;
+            _responder.Finish(::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "malformed request"), this);
+            return true;
+        }
+
+        _name = request.name();
+        const auto admitted = _shard->admission->admit_stream(_name, _context, _ticket);
+        if (!admitted.ok()) {
+            _metrics.fail();
+            _state = handler_state::FINISH;
+            _responder.Finish(admitted, this);
+            return true;
+        }
+
+        _compression.start(_context);
+        _state = handler_state::STREAM;
+        _topic = &_shard->topics.find_or_create(_shard.get(), _name);
+        _topic->subscribe(this, request.resume_after());
+        return true;
+    }
+
+    // write completion
+    _writing = false;
+    _metrics.sent();
+
+    if (!_send_queue.empty()) {
+        write();
+    } else if (_last) {
+        _topic->unsubscribe(this, false);
+        _topic = nullptr;
+        _state = handler_state::FINISH;
+        _responder.Finish(grpc_status::OK, this);
+    }
+
+    return true;
 }
 
-void stream_int_server_handler::handle_write_state()
+void stream_string_server_handler::publish(const ::grpc::ByteBuffer& update, bool last)
 {
-    LOG("stream_int_server_handler::handle_write_state()");
+    if (_last || _done.cancelled())
+        return;
 
-    if (amount > 0) {
-        // std::this_thread::sleep_for(1000ms);
-        std::this_thread::sleep_for(10ms);
-        _reply.set_msg(amount--);
-        LOG("stream_int_server_handler::handle_write_state(): write '" + std::to_string(_reply.msg()) + "'");
-        _responder.Write(_reply, this);
+    // copies share the slices of the update, BLOCK turns into a drop: the topic never waits for one subscriber
+    auto value = update;
+    if (!_send_queue.push(_name, std::move(value)))
+        ++_shard->send_queues.dropped;
+
+    _last = last;
+    if (!_writing && !_send_queue.empty())
+        write();
+}
+
+void stream_string_server_handler::write()
+{
+    _writing = true;
+    const auto& update = _send_queue.front();
+    _responder.Write(update, _compression.write_options(update), this);
+    _send_queue.pop();
+}
+
+void stream_string_server_handler::call_done()
+{
+    if (_idle) {
+        release();
+        return;
+    }
+
+    if (!_done.cancelled() || _state != handler_state::STREAM)
+        return;
+
+    LOG_DEBUG("stream_string_server_handler::call_done(name=%s): cancelled, leave the topic", _name.c_str());
+    _topic->unsubscribe(this, true);
+    _topic = nullptr;
+
+    // waiting for the next update of the topic, nothing is pending
+    if (!_writing) {
+        _metrics.fail();
+        release();
+    }
+}
+
+void stream_string_server_handler::release_after_done()
+{
+    if (_done.pending()) {
+        _idle = true;
+        return;
+    }
+
+    release();
+}
+
+void stream_string_server_handler::release()
+{
+    // still subscribed: the call failed before its last update
+    if (_topic)
+        _topic->unsubscribe(this, true);
+
+    const auto shard = _shard;
+    shard->stream_string_handlers.destroy(this);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+#ifdef FRANKENSTEIN_COROUTINES
+coroutine_task stream_int_coroutine(frame_allocator& frames, server_shard_ptr shard)
+{
+    using tag = server_coroutine_stub;
+
+    const auto queue = shard->queue.get();
+    grpc_server_context context;
+    server_async_writer<proto::IntReply> responder(&context);
+    proto::NameRequest request;
+    proto::IntReply reply;
+    call_metrics metrics(metric_side::SERVER, metric_method::STREAM_INT, nullptr);
+    server_coroutine_done done;
+
+    done.watch(context);
+    const bool requested = co_await on_tag<tag>([&](void* call_tag) {
+        shard->service->RequestStreamInt(&context, &request, &responder, queue, queue, call_tag);
+    });
+    if (!requested) {
+        LOG_DEBUG("stream_int_coroutine(): server has been shut down before receiving a matching request");
+        co_return;
+    }
+
+    metrics.start();
+    stream_int_coroutine(frames, shard);
+
+    admission_ticket ticket;
+    const auto admitted = shard->admission->admit_stream(request.name(), context, ticket);
+    if (!admitted.ok()) {
+        metrics.fail();
+        co_await async_finish<tag>(responder, admitted);
+        co_await done;
+        co_return;
+    }
+
+    call_compression compression(shard->options.compression, metric_method::STREAM_INT, shard->compression);
+    compression.start(context);
+
+    // fixed rate: a late alarm does not shift the following ones unless the stream fell behind entirely, the rate
+    // limit holds messages back on top of that
+    ::grpc::Alarm alarm;
+    const auto interval = shard->options.stream_interval;
+    auto rate = shard->options.admission.message_limit();
+    chr::system_clock::time_point next_write;
+    auto pace = [&]() {
+        const auto now = chr::system_clock::now();
+        if (next_write.time_since_epoch().count() == 0)
+            next_write = now;
+        next_write = rate.reserve(std::max(now, next_write + interval));
+        return async_alarm<tag>(alarm, queue, next_write);
+    };
+
+    // an empty message first, then the countdown, the last value goes once more with the end of the stream. A resumed
+    // call skips the values up to its resume point, the seq of a value is its position in the countdown.
+    auto amount = shard->options.stream_length;
+    const auto skipped = static_cast<std::size_t>(std::min<uint64_t>(request.resume_after(), amount));
+    amount -= skipped;
+    uint64_t seq = skipped;
+    bool ok = co_await async_write<tag>(responder, reply, compression.write_options(reply));
+    while (ok) {
+        metrics.sent();
+        if (interval.count() > 0 || rate.limited()) {
+            done.pacing = &alarm;
+            ok = co_await pace();
+            done.pacing = nullptr;
+            if (!ok || done.cancelled()) {
+                ok = false;
+                break;
+            }
+        }
+
+        if (amount == 0) {
+            ok = co_await async_write_and_finish<tag>(
+                responder, reply, grpc_status::OK, compression.write_options(reply));
+            break;
+        }
+
+        reply.set_msg(static_cast<int32_t>(amount--));
+        reply.set_seq(++seq);
+        reply.set_sent_at_ns(wall_clock_ns());
+        LOG_TRACE("stream_int_coroutine(): write '%d'", reply.msg());
+        ok = co_await async_write<tag>(responder, reply, compression.write_options(reply));
+    }
+
+    if (ok) {
+        metrics.sent();
     } else {
-        _state = handler_state::FINISH;
-        _responder.WriteAndFinish(_reply, ::grpc::WriteOptions(), grpc_status::OK, this);
+        LOG_DEBUG("stream_int_coroutine(): abort: call is cancelled or connection is dropped");
+        metrics.fail();
     }
+
+    // the done tag is a part of this frame
+    co_await done;
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+
+batch_coalescer::batch_coalescer(const server_options& options) :
+    _interval(options.stream_interval),
+    _batch_size(std::max<std::size_t>(1, options.stream_batch_size)),
+    _batch_delay(options.stream_batch_delay)
+{}
+
+chr::microseconds batch_coalescer::write_interval() const
+{
+    if (_interval.count() == 0)
+        return _interval;
+
+    return std::min(_batch_delay, _interval * static_cast<int64_t>(_batch_size));
+}
+
+std::size_t batch_coalescer::take(chr::system_clock::time_point now)
+{
+    // unlimited production rate: every batch is full
+    if (_interval.count() == 0) {
+        _backlog = true;
+        return _batch_size;
+    }
+
+    if (_next_value.time_since_epoch().count() == 0)
+        _next_value = now;
+
+    std::size_t count = 0;
+    while (count < _batch_size && _next_value <= now) {
+        _next_value += _interval;
+        ++count;
+    }
+
+    _backlog = _next_value <= now;
+    return count;
 }
 
 } // namespace frankenstein
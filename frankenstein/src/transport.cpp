@@ -0,0 +1,49 @@
+#include <frankenstein/transport.hpp>
+
+namespace frankenstein {
+
+const char* to_string(transport_kind kind)
+{
+    switch (kind) {
+        case transport_kind::TCP:
+            return "tcp";
+        case transport_kind::UNIX:
+            return "unix";
+        case transport_kind::IN_PROCESS:
+            return "inprocess";
+        default:
+            return "";
+    }
+}
+
+bool from_string(const std::string& name, transport_options& transport)
+{
+    static const std::string unix_prefix = "unix:";
+
+    if (name == "tcp") {
+        transport.kind = transport_kind::TCP;
+    } else if (name == "inprocess") {
+        transport.kind = transport_kind::IN_PROCESS;
+    } else if (name.compare(0, unix_prefix.size(), unix_prefix) == 0 && name.size() > unix_prefix.size()) {
+        transport.kind = transport_kind::UNIX;
+        transport.path = name.substr(unix_prefix.size());
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+std::string transport_address(const transport_options& transport, const std::string& tcp_address)
+{
+    switch (transport.kind) {
+        case transport_kind::UNIX:
+            return "unix:" + transport.path;
+        case transport_kind::IN_PROCESS:
+            return {};
+        default:
+            return tcp_address;
+    }
+}
+
+} // namespace frankenstein